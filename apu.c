@@ -0,0 +1,794 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "apu.h"
+#include "trace.h"
+
+# define UNUSED(x) (void)(x)
+
+/* Frame sequencer steps in CPU cycles after a $4017 write */
+#define SEQ_STEP1 7457
+#define SEQ_STEP2 14913
+#define SEQ_STEP3 22371
+#define SEQ_STEP4 29829       /* 4-step mode, frame IRQ */
+#define SEQ_STEP4_5 37281     /* 5-step mode */
+#define SEQ_PERIOD 29830
+#define SEQ_PERIOD_5 37282
+
+#define SILENT 0x7FFFFFFF     /* timer that never expires */
+
+static const unsigned char lengthTable[32] = {
+	10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+	12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const unsigned char dutyTable[4][8] = {
+	{ 0, 1, 0, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 1, 1, 0, 0, 0 },
+	{ 1, 0, 0, 1, 1, 1, 1, 1 }
+};
+
+static const unsigned char triTable[32] = {
+	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+/* noise periods in CPU cycles */
+static const unsigned short noiseTable[16] = {
+	4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+
+/* nonlinear mixer lookup tables */
+static float pulseMix[31];
+static float tndMix[203];
+static pthread_once_t mixOnce = PTHREAD_ONCE_INIT;
+
+static void
+apu_mixTables()
+{
+	int i;
+
+	pulseMix[0] = 0;
+	for (i = 1; i < 31; i++) {
+		pulseMix[i] = 95.52 / (8128.0 / i + 100);
+	}
+
+	tndMix[0] = 0;
+	for (i = 1; i < 203; i++) {
+		tndMix[i] = 163.67 / (24329.0 / i + 100);
+	}
+}
+
+/*
+ *
+ * CPU thread: analytical models and the write log
+ *
+ */
+
+/* Number of half frame clocks from the start of the sequence up to t. */
+static unsigned long long
+apu_halfFrames(Apu* apu, unsigned long long t)
+{
+	unsigned long long d = t - apu->seqStart;
+	unsigned long long period = apu->mode5 ? SEQ_PERIOD_5 : SEQ_PERIOD;
+	unsigned long long second = apu->mode5 ? SEQ_STEP4_5 : SEQ_STEP4;
+	unsigned long long r = d % period;
+
+	return (d / period) * 2 + (r >= SEQ_STEP2) + (r >= second);
+}
+
+/* Current value of a length counter, derived from when it was loaded. */
+static unsigned char
+apu_lengthNow(Apu* apu, int ch)
+{
+	LENGTH* l = &apu->length[ch];
+	unsigned long long clocks;
+
+	if (l->halted || l->count == 0) {
+		return l->count;
+	}
+
+	clocks = apu_halfFrames(apu, apu->cpu->clocks) - apu_halfFrames(apu, l->at);
+	return clocks >= l->count ? 0 : l->count - clocks;
+}
+
+/* Folds elapsed half frames into the count before the model changes. */
+static void
+apu_rebase(Apu* apu, int ch)
+{
+	apu->length[ch].count = apu_lengthNow(apu, ch);
+	apu->length[ch].at = apu->cpu->clocks;
+}
+
+/*
+ * Frame IRQ event. The IRQ is raised once when the flag gets set
+ * rather than held as a level until $4015 is read.
+ */
+static void
+apu_frameIrq(void* user, unsigned long long when)
+{
+	Apu* apu = user;
+
+	apu->frameIrq = 1;
+	cpu_irq(apu->cpu);
+	sched_add(&apu->cpu->bus->sched, when + SEQ_PERIOD, apu_frameIrq, apu);
+}
+
+/* Restarts the frame sequence at the current cycle. */
+static void
+apu_restart(Apu* apu)
+{
+	Scheduler* sched = &apu->cpu->bus->sched;
+
+	apu->seqStart = apu->cpu->clocks;
+
+	sched_cancel(sched, apu_frameIrq, apu);
+	if (!apu->mode5 && !apu->irqInhibit) {
+		sched_add(sched, apu->seqStart + SEQ_STEP4, apu_frameIrq, apu);
+	}
+}
+
+/* Appends a write to the log. Never blocks; drops if synthesis fell behind. */
+static void
+apu_log(Apu* apu, unsigned long long when, unsigned short addr, unsigned char data)
+{
+	unsigned int head = atomic_load_explicit(&apu->logHead, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&apu->logTail, memory_order_acquire);
+	APU_WRITE* w;
+
+	if (head - tail >= APU_LOG_SIZE) {
+		apu->dropped++;
+		return;
+	}
+
+	w = &apu->log[head & (APU_LOG_SIZE - 1)];
+	w->when = when;
+	w->addr = addr;
+	w->data = data;
+
+	atomic_store_explicit(&apu->logHead, head + 1, memory_order_release);
+}
+
+/* $4000-$40FF write handler */
+static void
+apu_write(void* user, unsigned short addr, unsigned char data)
+{
+	Apu* apu = user;
+	int ch = (addr >> 2) & 0x03;
+	int halt;
+
+	/* keep the last write visible to debuggers */
+	apu->cpu->bus->page[addr >> PAGE_BITS][addr & (PAGE_BYTES - 1)] = data;
+
+	if (addr > 0x4017 || addr == 0x4014 || addr == 0x4016) {
+		return;
+	}
+
+	switch (addr) {
+		case 0x4000: case 0x4004: case 0x4008: case 0x400C:
+			halt = (addr == 0x4008) ? (data & 0x80) != 0 : (data & 0x20) != 0;
+			if (halt != apu->length[ch].halted) {
+				apu_rebase(apu, ch);
+				apu->length[ch].halted = halt;
+			}
+			break;
+
+		case 0x4003: case 0x4007: case 0x400B: case 0x400F:
+			if (apu->enabled & (1 << ch)) {
+				apu->length[ch].count = lengthTable[data >> 3];
+				apu->length[ch].at = apu->cpu->clocks;
+			}
+			break;
+
+		case 0x4015:
+			apu->enabled = data & 0x0F;
+			for (ch = 0; ch < 4; ch++) {
+				if (!(apu->enabled & (1 << ch))) {
+					apu->length[ch].count = 0;
+				}
+			}
+			break;
+
+		case 0x4017:
+			for (ch = 0; ch < 4; ch++) {
+				apu_rebase(apu, ch);
+			}
+
+			apu->mode5 = (data & 0x80) != 0;
+			apu->irqInhibit = (data & 0x40) != 0;
+			if (apu->irqInhibit) {
+				apu->frameIrq = 0;
+			}
+
+			/* 5-step mode clocks the length counters right away */
+			if (apu->mode5) {
+				for (ch = 0; ch < 4; ch++) {
+					if (!apu->length[ch].halted && apu->length[ch].count > 0) {
+						apu->length[ch].count--;
+					}
+				}
+			}
+
+			apu_restart(apu);
+			break;
+	}
+
+	apu_log(apu, apu->cpu->clocks, addr, data);
+}
+
+/* $4000-$40FF read handler */
+static unsigned char
+apu_read(void* user, unsigned short addr)
+{
+	Apu* apu = user;
+	unsigned char status = 0;
+	int ch;
+
+	if (addr != 0x4015) {
+		return apu->cpu->bus->page[addr >> PAGE_BITS][addr & (PAGE_BYTES - 1)];
+	}
+
+	for (ch = 0; ch < 4; ch++) {
+		if (apu_lengthNow(apu, ch) > 0) {
+			status |= 1 << ch;
+		}
+	}
+
+	if (apu->frameIrq) {
+		status |= 0x40;
+	}
+	apu->frameIrq = 0;
+
+	return status;
+}
+
+/*
+ *
+ * Synthesis: replays the log and runs the channels
+ *
+ */
+
+static void
+apu_envelope(ENVELOPE* env)
+{
+	if (env->start) {
+		env->start = 0;
+		env->decay = 15;
+		env->divider = env->volume;
+	} else if (env->divider == 0) {
+		env->divider = env->volume;
+		if (env->decay > 0) {
+			env->decay--;
+		} else if (env->loop) {
+			env->decay = 15;
+		}
+	} else {
+		env->divider--;
+	}
+}
+
+static int
+apu_sweepTarget(PULSE* p)
+{
+	int change = p->period >> p->sweepShift;
+
+	if (p->sweepNegate) {
+		return p->period - change - p->ones;
+	}
+	return p->period + change;
+}
+
+static void
+apu_sweep(PULSE* p)
+{
+	int target = apu_sweepTarget(p);
+
+	if (p->sweepDivider == 0 && p->sweepOn && p->sweepShift > 0 && p->period >= 8 && target >= 0 && target <= 0x7FF) {
+		p->period = target;
+	}
+
+	if (p->sweepDivider == 0 || p->sweepReload) {
+		p->sweepDivider = p->sweepPeriod;
+		p->sweepReload = 0;
+	} else {
+		p->sweepDivider--;
+	}
+}
+
+/* Quarter frame: envelopes and the triangle's linear counter */
+static void
+apu_quarter(ApuSynth* s)
+{
+	apu_envelope(&s->pulse[0].env);
+	apu_envelope(&s->pulse[1].env);
+	apu_envelope(&s->noise.env);
+
+	if (s->tri.linearReload) {
+		s->tri.linear = s->tri.linearLoad;
+	} else if (s->tri.linear > 0) {
+		s->tri.linear--;
+	}
+
+	if (!s->tri.control) {
+		s->tri.linearReload = 0;
+	}
+}
+
+/* Half frame: length counters and sweeps */
+static void
+apu_half(ApuSynth* s)
+{
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!s->pulse[i].env.loop && s->pulse[i].length > 0) {
+			s->pulse[i].length--;
+		}
+		apu_sweep(&s->pulse[i]);
+	}
+
+	if (!s->tri.control && s->tri.length > 0) {
+		s->tri.length--;
+	}
+
+	if (!s->noise.env.loop && s->noise.length > 0) {
+		s->noise.length--;
+	}
+}
+
+/* Cycles until the next frame sequencer step. */
+static int
+apu_seqNext(ApuSynth* s)
+{
+	int last = s->mode5 ? SEQ_STEP4_5 : SEQ_STEP4;
+
+	if (s->seqCycle < SEQ_STEP1) return SEQ_STEP1 - s->seqCycle;
+	if (s->seqCycle < SEQ_STEP2) return SEQ_STEP2 - s->seqCycle;
+	if (s->seqCycle < SEQ_STEP3) return SEQ_STEP3 - s->seqCycle;
+	return last - s->seqCycle;
+}
+
+/* Runs the frame sequencer step the sequencer just reached. */
+static void
+apu_seqStep(ApuSynth* s)
+{
+	int last = s->mode5 ? SEQ_STEP4_5 : SEQ_STEP4;
+
+	apu_quarter(s);
+
+	if (s->seqCycle == SEQ_STEP2 || s->seqCycle == last) {
+		apu_half(s);
+	}
+
+	if (s->seqCycle == last) {
+		s->seqCycle -= s->mode5 ? SEQ_PERIOD_5 : SEQ_PERIOD;
+	}
+}
+
+static unsigned char
+apu_pulseOut(PULSE* p)
+{
+	if (p->length == 0 || p->period < 8 || apu_sweepTarget(p) > 0x7FF || !dutyTable[p->duty][p->step]) {
+		return 0;
+	}
+	return p->env.constant ? p->env.volume : p->env.decay;
+}
+
+static unsigned char
+apu_noiseOut(NOISE* n)
+{
+	if (n->length == 0 || (n->shift & 1)) {
+		return 0;
+	}
+	return n->env.constant ? n->env.volume : n->env.decay;
+}
+
+/* Pushes a finished sample to the output ring. Drops if the ring is full. */
+static void
+apu_push(Apu* apu, short sample)
+{
+	unsigned int head = atomic_load_explicit(&apu->ringHead, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&apu->ringTail, memory_order_acquire);
+
+	if (head - tail >= APU_RING_SIZE) {
+		return;
+	}
+
+	apu->ring[head & (APU_RING_SIZE - 1)] = sample;
+	atomic_store_explicit(&apu->ringHead, head + 1, memory_order_release);
+}
+
+/*
+ * Synthesizes up to the input CPU cycle.
+ * Channel outputs only change when a timer or the sequencer fires, so the
+ * loop jumps from one such event to the next and integrates the mixer
+ * output over each span (a box filter per output sample).
+ */
+static void
+apu_run(Apu* apu, unsigned long long until)
+{
+	ApuSynth* s = &apu->synth;
+	PULSE* p;
+	int n, i, next;
+	int live;
+	float mix, y;
+
+	while (s->clock < until) {
+		n = until - s->clock > SILENT ? SILENT : (int)(until - s->clock);
+
+		next = apu_seqNext(s);
+		if (next < n) n = next;
+
+		next = (int)(s->cyclesPerSample - s->sampleClock) + 1;
+		if (next < n) n = next;
+
+		/*
+		 * Silent channels do not run their timers, so they cost nothing.
+		 * Ultrasonic triangle periods are frozen rather than aliased.
+		 */
+		live = 0;
+		for (i = 0; i < 2; i++) {
+			if (s->pulse[i].length > 0 && s->pulse[i].period >= 8) {
+				live |= 1 << i;
+				if ((int)s->pulse[i].timer < n) n = s->pulse[i].timer;
+			}
+		}
+		if (s->tri.period >= 2 && s->tri.length > 0 && s->tri.linear > 0) {
+			live |= 1 << 2;
+			if ((int)s->tri.timer < n) n = s->tri.timer;
+		}
+		if (s->noise.length > 0) {
+			live |= 1 << 3;
+			if ((int)s->noise.timer < n) n = s->noise.timer;
+		}
+
+		if (n < 1) n = 1;
+
+		/* integrate the current output over the span */
+		mix = pulseMix[apu_pulseOut(&s->pulse[0]) + apu_pulseOut(&s->pulse[1])]
+			+ tndMix[3 * triTable[s->tri.step] + 2 * apu_noiseOut(&s->noise) + s->dmc];
+		s->acc += mix * n;
+		s->accCount += n;
+
+		/* advance timers */
+		for (i = 0; i < 2; i++) {
+			p = &s->pulse[i];
+			if (!(live & (1 << i))) {
+				continue;
+			}
+			p->timer -= n;
+			if (p->timer == 0) {
+				p->timer = (p->period + 1) * 2;
+				p->step = (p->step + 1) & 7;
+			}
+		}
+
+		if (live & (1 << 3)) {
+			s->noise.timer -= n;
+			if (s->noise.timer == 0) {
+				s->noise.timer = s->noise.period;
+				s->noise.shift = (s->noise.shift >> 1)
+					| ((((s->noise.shift) ^ (s->noise.shift >> (s->noise.mode ? 6 : 1))) & 1) << 14);
+			}
+		}
+
+		if (live & (1 << 2)) {
+			s->tri.timer -= n;
+			if (s->tri.timer == 0) {
+				s->tri.timer = s->tri.period + 1;
+				s->tri.step = (s->tri.step + 1) & 31;
+			}
+		}
+
+		s->seqCycle += n;
+		if (apu_seqNext(s) == 0) {
+			apu_seqStep(s);
+		}
+
+		s->clock += n;
+
+		/* emit a sample through a DC blocking high-pass */
+		s->sampleClock += n;
+		if (s->sampleClock >= s->cyclesPerSample) {
+			s->sampleClock -= s->cyclesPerSample;
+
+			mix = s->acc / s->accCount;
+			y = mix - s->hpIn + 0.995f * s->hpOut;
+			s->hpIn = mix;
+			s->hpOut = y;
+			s->acc = 0;
+			s->accCount = 0;
+
+			y *= 32767.0f;
+			apu_push(apu, y > 32767.0f ? 32767 : (y < -32768.0f ? -32768 : (short)y));
+		}
+	}
+}
+
+/* Applies a logged register write to the synthesis state. */
+static void
+apu_apply(ApuSynth* s, unsigned short addr, unsigned char data)
+{
+	PULSE* p = &s->pulse[(addr >> 2) & 1];
+	int i;
+
+	switch (addr) {
+		case 0x4000: case 0x4004:
+			p->duty = data >> 6;
+			p->env.loop = (data & 0x20) != 0;
+			p->env.constant = (data & 0x10) != 0;
+			p->env.volume = data & 0x0F;
+			break;
+
+		case 0x4001: case 0x4005:
+			p->sweepOn = (data & 0x80) != 0;
+			p->sweepPeriod = (data >> 4) & 0x07;
+			p->sweepNegate = (data & 0x08) != 0;
+			p->sweepShift = data & 0x07;
+			p->sweepReload = 1;
+			break;
+
+		case 0x4002: case 0x4006:
+			p->period = (p->period & 0x0700) | data;
+			break;
+
+		case 0x4003: case 0x4007:
+			p->period = (p->period & 0x00FF) | ((data & 0x07) << 8);
+			if (s->enabled & (1 << ((addr >> 2) & 1))) {
+				p->length = lengthTable[data >> 3];
+			}
+			p->step = 0;
+			p->env.start = 1;
+			break;
+
+		case 0x4008:
+			s->tri.control = (data & 0x80) != 0;
+			s->tri.linearLoad = data & 0x7F;
+			break;
+
+		case 0x400A:
+			s->tri.period = (s->tri.period & 0x0700) | data;
+			break;
+
+		case 0x400B:
+			s->tri.period = (s->tri.period & 0x00FF) | ((data & 0x07) << 8);
+			if (s->enabled & 0x04) {
+				s->tri.length = lengthTable[data >> 3];
+			}
+			s->tri.linearReload = 1;
+			break;
+
+		case 0x400C:
+			s->noise.env.loop = (data & 0x20) != 0;
+			s->noise.env.constant = (data & 0x10) != 0;
+			s->noise.env.volume = data & 0x0F;
+			break;
+
+		case 0x400E:
+			s->noise.mode = (data & 0x80) != 0;
+			s->noise.period = noiseTable[data & 0x0F];
+			break;
+
+		case 0x400F:
+			if (s->enabled & 0x08) {
+				s->noise.length = lengthTable[data >> 3];
+			}
+			s->noise.env.start = 1;
+			break;
+
+		case 0x4011:
+			s->dmc = data & 0x7F;
+			break;
+
+		case 0x4015:
+			s->enabled = data & 0x0F;
+			for (i = 0; i < 2; i++) {
+				if (!(s->enabled & (1 << i))) {
+					s->pulse[i].length = 0;
+				}
+			}
+			if (!(s->enabled & 0x04)) {
+				s->tri.length = 0;
+			}
+			if (!(s->enabled & 0x08)) {
+				s->noise.length = 0;
+			}
+			break;
+
+		case 0x4017:
+			s->mode5 = (data & 0x80) != 0;
+			s->seqCycle = 0;
+			if (s->mode5) {
+				apu_quarter(s);
+				apu_half(s);
+			}
+			break;
+	}
+}
+
+/*
+ * Replays every logged write, synthesizing the time between them.
+ * returns the number of log entries consumed
+ */
+static int
+apu_drain(Apu* apu)
+{
+	unsigned int tail = atomic_load_explicit(&apu->logTail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&apu->logHead, memory_order_acquire);
+	int n = head - tail;
+	Perf* perf = apu->cpu->bus->perf;
+	unsigned long long start = perf ? perf_now() : 0;
+	unsigned long long span = trace_begin();
+	APU_WRITE* w;
+
+	apu->synth.cyclesPerSample = (double)APU_CLOCK / APU_RATE
+		* (1.0 + atomic_load_explicit(&apu->ratePpm, memory_order_relaxed) * 1e-6);
+
+	for (; tail != head; tail++) {
+		w = &apu->log[tail & (APU_LOG_SIZE - 1)];
+		apu_run(apu, w->when);
+		if (w->addr != APU_SYNC) {
+			apu_apply(&apu->synth, w->addr, w->data);
+		}
+	}
+
+	atomic_store_explicit(&apu->logTail, tail, memory_order_release);
+
+	if (perf && n > 0) {
+		perf_add(perf, PERF_APU, start);
+	}
+	if (n > 0) {
+		trace_end("apu synth", span);
+	}
+	return n;
+}
+
+/* Synthesis thread: replays the log as it fills. */
+static void*
+apu_thread(void* user)
+{
+	Apu* apu = user;
+
+	trace_thread("apu");
+
+	while (!atomic_load(&apu->stop)) {
+		if (apu_drain(apu) == 0) {
+			usleep(1000);
+		}
+	}
+
+	return NULL;
+}
+
+/* Frame hook: lets synthesis catch up to the end of the frame. */
+static void
+apu_frame(void* user, HOOK_EVENT ev, unsigned short addr, unsigned char data)
+{
+	UNUSED(ev);
+	UNUSED(addr);
+	UNUSED(data);
+
+	apu_sync(user);
+}
+
+/*
+ * Attaches the APU registers to the CPU's bus.
+ * With threaded set, synthesis runs on its own thread; otherwise it
+ * runs inline on the CPU thread at every frame end.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+apu_init(Apu* apu, CPU* cpu, int threaded)
+{
+	int i;
+
+	pthread_once(&mixOnce, apu_mixTables);
+
+	memset(apu, 0, sizeof(Apu));
+	apu->cpu = cpu;
+	apu->threaded = threaded;
+
+	apu->synth.clock = cpu->clocks;
+	apu->synth.cyclesPerSample = (double)APU_CLOCK / APU_RATE;
+	apu->synth.noise.shift = 1;
+	apu->synth.noise.period = noiseTable[0];
+	apu->synth.noise.timer = noiseTable[0];
+	apu->synth.tri.timer = 1;
+	for (i = 0; i < 2; i++) {
+		apu->synth.pulse[i].timer = 2;
+	}
+	apu->synth.pulse[0].ones = 1;
+
+	if (!bus_hook(cpu->bus, HOOK_FRAME, apu_frame, apu, 0x0000, 0xFFFF)) {
+		return 0;
+	}
+
+	bus_mapIO(cpu->bus, 0x4000 >> PAGE_BITS, apu_read, apu_write, apu);
+	apu_restart(apu);
+
+	if (threaded && pthread_create(&apu->thread, NULL, apu_thread, apu) != 0) {
+		perror("apu");
+		apu->threaded = 0;
+	}
+
+	return 1;
+}
+
+/* Stops synthesis and detaches the registers from the bus. */
+void
+apu_close(Apu* apu)
+{
+	if (apu->cpu == NULL) {
+		return;
+	}
+
+	if (apu->threaded) {
+		atomic_store(&apu->stop, 1);
+		pthread_join(apu->thread, NULL);
+		apu->threaded = 0;
+	}
+
+	sched_cancel(&apu->cpu->bus->sched, apu_frameIrq, apu);
+	bus_unhook(apu->cpu->bus, HOOK_FRAME, apu_frame, apu);
+	bus_mapIO(apu->cpu->bus, 0x4000 >> PAGE_BITS, NULL, NULL, NULL);
+	apu->cpu = NULL;
+}
+
+/*
+ * Marks the current cycle in the log so synthesis can run up to it
+ * even without new writes. Inline mode synthesizes right away.
+ */
+void
+apu_sync(Apu* apu)
+{
+	apu_log(apu, apu->cpu->clocks, APU_SYNC, 0);
+
+	if (!apu->threaded) {
+		apu_drain(apu);
+	}
+}
+
+/*
+ * Takes up to max synthesized samples.
+ * returns the number of samples copied
+ */
+int
+apu_samples(Apu* apu, short* out, int max)
+{
+	unsigned int tail = atomic_load_explicit(&apu->ringTail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&apu->ringHead, memory_order_acquire);
+	int n = 0;
+
+	while (tail != head && n < max) {
+		out[n++] = apu->ring[tail & (APU_RING_SIZE - 1)];
+		tail++;
+	}
+
+	atomic_store_explicit(&apu->ringTail, tail, memory_order_release);
+	return n;
+}
+
+/* returns the number of synthesized samples waiting to be taken */
+int
+apu_buffered(Apu* apu)
+{
+	return atomic_load_explicit(&apu->ringHead, memory_order_acquire)
+		- atomic_load_explicit(&apu->ringTail, memory_order_relaxed);
+}
+
+/*
+ * Nudges the output rate by ppm parts per million so a consumer with
+ * its own clock can keep its buffer level steady. Positive values make
+ * fewer samples per emulated second. Clamped to APU_RATE_MAX.
+ */
+void
+apu_setRate(Apu* apu, int ppm)
+{
+	if (ppm > APU_RATE_MAX) ppm = APU_RATE_MAX;
+	if (ppm < -APU_RATE_MAX) ppm = -APU_RATE_MAX;
+
+	atomic_store_explicit(&apu->ratePpm, ppm, memory_order_relaxed);
+}
@@ -0,0 +1,154 @@
+#ifndef APU_H
+#define APU_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "cpu.h"
+
+/*
+ * Audio processing unit ($4000-$4017).
+ *
+ * The work is split in two halves. The CPU thread only keeps what the
+ * guest can observe (frame IRQ, length counter status at $4015) through
+ * cheap analytical models, and appends every register write to a
+ * timestamped log. The synthesis half replays that log to run the
+ * channels and produce samples, either inline at frame end or on its
+ * own thread so audio costs the emulation thread almost nothing.
+ *
+ * DMC sample playback (memory reads, DMC IRQ and CPU stalls) is not
+ * emulated; $4011 direct loads are.
+ */
+#define APU_CLOCK 1789773      /* NTSC CPU clock in Hz */
+#define APU_RATE 44100         /* output sample rate */
+#define APU_LOG_SIZE 8192      /* register writes in flight, power of two */
+#define APU_RING_SIZE 16384    /* output samples in flight, power of two */
+#define APU_SYNC 0xFFFF        /* log marker: guest time advanced */
+#define APU_RATE_MAX 5000      /* output rate adjustment limit, ppm */
+
+typedef struct apuWrite APU_WRITE;
+typedef struct length LENGTH;
+typedef struct envelope ENVELOPE;
+typedef struct pulse PULSE;
+typedef struct triangle TRIANGLE;
+typedef struct noise NOISE;
+typedef struct apuSynth ApuSynth;
+typedef struct apu Apu;
+
+struct apuWrite {
+	unsigned long long when;  /* CPU cycle of the write */
+	unsigned short addr;      /* register, or APU_SYNC */
+	unsigned char data;
+};
+
+/* CPU side length counter model */
+struct length {
+	unsigned char count;      /* value at the time below */
+	unsigned char halted;
+	unsigned long long at;
+};
+
+struct envelope {
+	unsigned char start;
+	unsigned char loop;       /* also halts the length counter */
+	unsigned char constant;
+	unsigned char volume;     /* constant volume or envelope period */
+	unsigned char divider;
+	unsigned char decay;
+};
+
+struct pulse {
+	ENVELOPE env;
+	unsigned char duty;
+	unsigned char step;
+	unsigned short period;
+	unsigned short timer;
+	unsigned char length;
+	unsigned char sweepOn;
+	unsigned char sweepPeriod;
+	unsigned char sweepNegate;
+	unsigned char sweepShift;
+	unsigned char sweepReload;
+	unsigned char sweepDivider;
+	unsigned char ones;       /* 1 for pulse 1 (ones' complement negate) */
+};
+
+struct triangle {
+	unsigned char control;
+	unsigned char linearLoad;
+	unsigned char linear;
+	unsigned char linearReload;
+	unsigned char step;
+	unsigned short period;
+	unsigned short timer;
+	unsigned char length;
+};
+
+struct noise {
+	ENVELOPE env;
+	unsigned char mode;
+	unsigned short period;
+	unsigned short timer;
+	unsigned short shift;
+	unsigned char length;
+};
+
+/* Synthesis state, only touched by the synthesis side */
+struct apuSynth {
+	PULSE pulse[2];
+	TRIANGLE tri;
+	NOISE noise;
+	unsigned char dmc;        /* DMC output level */
+	unsigned char enabled;
+
+	unsigned char mode5;      /* 5-step frame sequence */
+	int seqCycle;             /* CPU cycles into the sequence */
+
+	unsigned long long clock; /* CPU cycle synthesized up to */
+	double cyclesPerSample;
+	double sampleClock;
+	float acc;
+	int accCount;
+	float hpIn;               /* DC blocking filter state */
+	float hpOut;
+};
+
+struct apu {
+	CPU* cpu;
+
+	/* CPU thread models */
+	unsigned char enabled;    /* $4015 channel enables */
+	unsigned char mode5;
+	unsigned char irqInhibit;
+	unsigned char frameIrq;
+	unsigned long long seqStart;
+	LENGTH length[4];
+
+	/* register write log: CPU thread -> synthesis */
+	APU_WRITE log[APU_LOG_SIZE];
+	atomic_uint logHead;
+	atomic_uint logTail;
+	unsigned long dropped;
+
+	/* samples: synthesis -> audio output */
+	short ring[APU_RING_SIZE];
+	atomic_uint ringHead;
+	atomic_uint ringTail;
+	atomic_int ratePpm;       /* output rate adjustment from the consumer */
+
+	ApuSynth synth;
+
+	/* synthesis thread */
+	int threaded;
+	atomic_int stop;
+	pthread_t thread;
+};
+
+int apu_init(Apu* apu, CPU* cpu, int threaded);
+void apu_close(Apu* apu);
+void apu_sync(Apu* apu);
+int apu_samples(Apu* apu, short* out, int max);
+int apu_buffered(Apu* apu);
+void apu_setRate(Apu* apu, int ppm);
+
+#endif
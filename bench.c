@@ -0,0 +1,366 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "core.h"
+#include "apu.h"
+#include "micro.h"
+
+/*
+ * Benchmark harness.
+ * Runs headless guest workloads for a fixed number of frames and reports
+ * guest MHz. When the kernel allows it, hardware counters are read around
+ * each workload and reported per guest instruction, which is where
+ * dispatch changes show up (branch misses in particular). Without
+ * counter access those columns are left out.
+ *
+ * With --micro it runs the microbenchmarks in micro.c instead.
+ */
+void usage(char* program);
+
+/* macros */
+#define DEFAULT_FRAMES 600   /* 10 s of guest time */
+#define COUNTERS 4
+
+typedef struct workload WORKLOAD;
+typedef struct counters COUNTERS_SET;
+
+struct workload {
+	const char* name;
+	const char* program;   /* hex bytes at $8000 */
+	int apu;               /* attach the APU (inline synthesis) */
+};
+
+struct counters {
+	int fd[COUNTERS];
+	int open;              /* counters that could be opened */
+	unsigned long long value[COUNTERS];
+};
+
+/*
+ * Guest workloads. Each is an endless loop at $8000.
+ */
+static const WORKLOAD workloads[] = {
+	/* LDX #0; loop: TXA; ADC #1; EOR #$5A; ASL; ROR; INX; BNE loop; JMP $8000 */
+	{ "alu", "A2 00 8A 69 01 49 5A 0A 6A E8 D0 F6 4C 00 80", 0 },
+
+	/* LDX #0; loop: LDA $0200,X; STA $0300,X; INX; BNE loop; JMP $8000 */
+	{ "memory", "A2 00 BD 00 02 9D 00 03 E8 D0 F7 4C 00 80", 0 },
+
+	/* LDX #0; loop: TXA; AND #3; BEQ +4; CMP #2; BNE +1; INX; INX; BNE loop; JMP $8000 */
+	{ "branch", "A2 00 8A 29 03 F0 04 C9 02 D0 01 E8 E8 D0 F3 4C 00 80", 0 },
+
+	/* loop: LDA #$BF; STA $4000; STX $4002; INX; BNE loop; JMP $8000 */
+	{ "apu", "A9 BF 8D 00 40 8E 02 40 E8 D0 F5 4C 00 80", 1 },
+
+	/* the built-in Fibonacci program with its RTS turned into JMP $8000 */
+	{ "fibonacci", "A9 00 8D F0 00 A9 01 8D F1 00 A2 00 AD F1 00 9D 1B 0F 8D F2 00 6D F0 00 8D F1 00 AD F2 00 8D F0 00 E8 E0 0A 30 E6 4C 00 80", 0 },
+};
+
+#define WORKLOADS (int)(sizeof(workloads) / sizeof(workloads[0]))
+
+static const struct {
+	unsigned int type;
+	unsigned long long config;
+	const char* name;
+} counterDefs[COUNTERS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instr" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "br-miss" },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+		| (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "L1d-miss" },
+};
+
+/*
+ * Opens the hardware counters for this thread.
+ * Each counter is opened on its own so one unsupported event does not
+ * take the others down. Unavailable counters keep fd -1.
+ */
+static void
+counters_open(COUNTERS_SET* set)
+{
+	struct perf_event_attr attr;
+	int i;
+
+	set->open = 0;
+
+	for (i = 0; i < COUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counterDefs[i].type;
+		attr.config = counterDefs[i].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		set->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (set->fd[i] >= 0) {
+			set->open++;
+		}
+	}
+}
+
+static void
+counters_start(COUNTERS_SET* set)
+{
+	int i;
+
+	for (i = 0; i < COUNTERS; i++) {
+		if (set->fd[i] >= 0) {
+			ioctl(set->fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(set->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+}
+
+static void
+counters_stop(COUNTERS_SET* set)
+{
+	int i;
+
+	for (i = 0; i < COUNTERS; i++) {
+		set->value[i] = 0;
+		if (set->fd[i] >= 0) {
+			ioctl(set->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+			if (read(set->fd[i], &set->value[i], sizeof(set->value[i])) != sizeof(set->value[i])) {
+				set->value[i] = 0;
+			}
+		}
+	}
+}
+
+static void
+counters_close(COUNTERS_SET* set)
+{
+	int i;
+
+	for (i = 0; i < COUNTERS; i++) {
+		if (set->fd[i] >= 0) {
+			close(set->fd[i]);
+			set->fd[i] = -1;
+		}
+	}
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Runs one workload for the input number of frames and prints a row.
+ * csv, when not NULL, gets the same row appended.
+ */
+static void
+runWorkload(const WORKLOAD* w, int frames, COUNTERS_SET* set, FILE* csv)
+{
+	static Bus bus;
+	static CPU cpu;
+	static Apu apu;
+	double start, took;
+	unsigned long long guest;
+	int i;
+
+	core_init(&bus, &cpu);
+	core_load(&bus, 0x8000, w->program);
+	bus.ram[0xFFFC] = 0x00;
+	bus.ram[0xFFFD] = 0x80;
+	cpu_reset(&cpu);
+
+	if (w->apu) {
+		apu_init(&apu, &cpu, 0);
+	}
+
+	counters_start(set);
+	start = now();
+
+	for (i = 0; i < frames; i++) {
+		core_frame(&cpu);
+	}
+
+	took = now() - start;
+	counters_stop(set);
+
+	if (w->apu) {
+		apu_close(&apu);
+	}
+
+	guest = cpu.instructions;
+	printf("%-10s %8.2f %8.2f", w->name, cpu.clocks / took / 1e6, guest / took / 1e6);
+	for (i = 0; i < COUNTERS && set->open > 0; i++) {
+		if (set->fd[i] >= 0) {
+			printf(" %9.2f", (double)set->value[i] / guest);
+		} else {
+			printf(" %9s", "-");
+		}
+	}
+	printf("\n");
+
+	if (csv != NULL) {
+		fprintf(csv, "%ld,%s,%d,%.4f,%.4f,%.4f", (long)time(NULL), w->name, frames,
+			took, cpu.clocks / took / 1e6, guest / took / 1e6);
+		for (i = 0; i < COUNTERS; i++) {
+			if (set->fd[i] >= 0) {
+				fprintf(csv, ",%.4f", (double)set->value[i] / guest);
+			} else {
+				fprintf(csv, ",");
+			}
+		}
+		fprintf(csv, "\n");
+	}
+}
+
+/*
+ * Usage Function
+ * Called when something isn't right with the command line parameters.
+ */
+void
+usage(char* program)
+{
+	printf("Usage: %s \n[--frames n] [--no-counters] [--csv file] [workload ...]\n%s --micro [--reps n] [--iters n] [micro ...]\n", program, program);
+}
+
+int
+main(int argc, char* argv[])
+{
+	COUNTERS_SET set;
+	FILE* csv = NULL;
+	char* csvFile = NULL;
+	int frames = DEFAULT_FRAMES;
+	int useCounters = 1;
+	int micro = 0;
+	int reps = MICRO_REPS;
+	long iters = MICRO_ITERS;
+	int ran = 0;
+	int i, j;
+
+	/* Params for getopt */
+	int ch;
+	int option_index = 0;
+
+	/* Defines the options and their long/short equivalents. */
+	struct option longopts[] = {
+		{ "frames", required_argument, NULL, 'f'},
+		{ "no-counters", no_argument, NULL, 'n'},
+		{ "csv", required_argument, NULL, 'c'},
+		{ "micro", no_argument, NULL, 'm'},
+		{ "reps", required_argument, NULL, 'r'},
+		{ "iters", required_argument, NULL, 'i'},
+		{ "help", no_argument, NULL, 'h'},
+		{ NULL, 0, NULL, 0 }
+	};
+
+	/* Processes the command-line parameters */
+	while ((ch = getopt_long(argc, argv, "f:nc:mr:i:h", longopts, &option_index)) != -1) {
+		switch (ch) {
+
+			case 'f':
+				frames = atoi(optarg);
+				break;
+
+			case 'n':
+				useCounters = 0;
+				break;
+
+			case 'c':
+				csvFile = optarg;
+				break;
+
+			case 'm':
+				micro = 1;
+				break;
+
+			case 'r':
+				reps = atoi(optarg);
+				break;
+
+			case 'i':
+				iters = atol(optarg);
+				break;
+
+			case 'h':
+				printf("Workloads:");
+				for (i = 0; i < WORKLOADS; i++) {
+					printf(" %s", workloads[i].name);
+				}
+				printf("\nCounter columns are per guest instruction. --csv appends rows for tracking over time.\n\n");
+				usage(argv[0]);
+				return 0;
+
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (micro) {
+		return micro_run(reps, iters, argc - optind, argv + optind) > 0 ? 0 : 1;
+	}
+
+	for (i = 0; i < COUNTERS; i++) {
+		set.fd[i] = -1;
+	}
+	set.open = 0;
+
+	if (useCounters) {
+		counters_open(&set);
+		if (set.open == 0) {
+			fprintf(stderr, "Hardware counters unavailable (perf_event_paranoid or no PMU), reporting times only.\n");
+		}
+	}
+
+	if (csvFile != NULL) {
+		csv = fopen(csvFile, "a");
+		if (csv == NULL) {
+			perror(csvFile);
+			counters_close(&set);
+			return 1;
+		}
+		if (ftell(csv) == 0) {
+			fprintf(csv, "time,workload,frames,seconds,mhz,mips");
+			for (i = 0; i < COUNTERS; i++) {
+				fprintf(csv, ",%s", counterDefs[i].name);
+			}
+			fprintf(csv, "\n");
+		}
+	}
+
+	printf("%-10s %8s %8s", "workload", "MHz", "MIPS");
+	for (i = 0; i < COUNTERS && set.open > 0; i++) {
+		printf(" %9s", counterDefs[i].name);
+	}
+	printf("\n");
+
+	for (i = 0; i < WORKLOADS; i++) {
+		/* run everything, or only the workloads named on the command line */
+		for (j = optind; j < argc && strcmp(argv[j], workloads[i].name) != 0; j++);
+		if (optind < argc && j == argc) {
+			continue;
+		}
+
+		runWorkload(&workloads[i], frames, &set, csv);
+		ran++;
+	}
+
+	if (ran == 0) {
+		fprintf(stderr, "no such workload\n");
+	}
+
+	if (csv != NULL) {
+		fclose(csv);
+	}
+	counters_close(&set);
+
+	return ran > 0 ? 0 : 1;
+}
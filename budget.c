@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "core.h"
+#include "budget.h"
+
+/* Branches, JMP and JMP () can close a wait loop. */
+#define IS_JUMP(op) (((op) & 0x1F) == 0x10 || (op) == 0x4C || (op) == 0x6C)
+
+static void
+budget_max(atomic_uint* worst, unsigned int value)
+{
+	if (value > atomic_load_explicit(worst, memory_order_relaxed)) {
+		atomic_store_explicit(worst, value, memory_order_relaxed);
+	}
+}
+
+/* Follows the NMI handler to its RTI and looks for the wait loop. */
+static void
+budget_exec(void* user, HOOK_EVENT ev, unsigned short pc, unsigned char op)
+{
+	Budget* budget = user;
+	CPU* cpu = budget->cpu;
+	unsigned short lastPc = budget->lastPc;
+	unsigned char lastOp = budget->lastOp;
+	unsigned long long regs;
+
+	(void)ev;
+
+	budget->lastPc = pc;
+	budget->lastOp = op;
+
+	if (budget->inNmi) {
+		if (op == 0x40 && cpu->stkp == budget->nmiSp) {
+			budget->nmiCycles += cpu->clocks + 6 - budget->nmiAt;
+			budget->inNmi = 0;
+		}
+		return;
+	}
+
+	/* the previous instruction jumped a short way back */
+	if (IS_JUMP(lastOp) && pc <= lastPc && lastPc - pc <= BUDGET_LOOP) {
+		regs = cpu->a | (cpu->x << 8) | (cpu->y << 16) | ((unsigned long long)cpu->status << 24)
+			| ((unsigned long long)cpu->stkp << 32);
+
+		if (budget->spins > 0 && pc == budget->loopTo && lastPc == budget->loopFrom && regs == budget->loopRegs) {
+			budget->spins++;
+		} else {
+			budget->loopFrom = lastPc;
+			budget->loopTo = pc;
+			budget->loopAt = cpu->clocks;
+			budget->loopRegs = regs;
+			budget->spins = 1;
+			budget->idle = 0;
+		}
+
+		if (budget->spins == BUDGET_SPINS) {
+			budget->idle = 1;
+			budget->idleAt = budget->loopAt > budget->frameStart ? budget->loopAt : budget->frameStart;
+		}
+	} else if (pc < budget->loopTo || pc > budget->loopFrom) {
+		budget->spins = 0;
+		budget->idle = 0;
+	}
+}
+
+/* NMI entry */
+static void
+budget_irq(void* user, HOOK_EVENT ev, unsigned short vector, unsigned char status)
+{
+	Budget* budget = user;
+	CPU* cpu = budget->cpu;
+
+	(void)ev;
+	(void)status;
+
+	if (vector != 0xFFFA || budget->inNmi) {
+		return;
+	}
+
+	budget->inNmi = 1;
+	budget->nmiAt = cpu->clocks;
+	budget->nmiSp = cpu->stkp;
+
+	if (budget->latency < 0) {
+		budget->latency = cpu->clocks - budget->frameStart;
+		budget_max(&budget->worstLatency, budget->latency);
+	}
+}
+
+/* Closes the frame: histogram, totals and a CSV row. */
+static void
+budget_frame(void* user, HOOK_EVENT ev, unsigned short addr, unsigned char data)
+{
+	Budget* budget = user;
+	unsigned long long end = budget->frameStart + FRAME_CYCLES;
+	unsigned long long busy;
+	unsigned long frame;
+	int bucket;
+
+	(void)ev;
+	(void)addr;
+	(void)data;
+
+	/* a handler still running is charged up to the frame end */
+	if (budget->inNmi) {
+		budget->nmiCycles += end - budget->nmiAt;
+		budget->nmiAt = end;
+	}
+
+	if (budget->idle) {
+		busy = budget->idleAt - budget->frameStart;
+		bucket = busy * 10 / FRAME_CYCLES;
+		if (bucket > BUDGET_BUCKETS - 2) {
+			bucket = BUDGET_BUCKETS - 2;
+		}
+	} else {
+		busy = FRAME_CYCLES;
+		bucket = BUDGET_BUCKETS - 1;
+		atomic_fetch_add_explicit(&budget->lags, 1, memory_order_relaxed);
+	}
+
+	atomic_fetch_add_explicit(&budget->hist[bucket], 1, memory_order_relaxed);
+	atomic_store_explicit(&budget->lastBusy, busy, memory_order_relaxed);
+	atomic_store_explicit(&budget->lastNmi, budget->nmiCycles, memory_order_relaxed);
+	budget_max(&budget->worstBusy, busy);
+	budget_max(&budget->worstNmi, budget->nmiCycles);
+	frame = atomic_fetch_add_explicit(&budget->frames, 1, memory_order_relaxed);
+
+	if (budget->csv != NULL) {
+		fprintf(budget->csv, "%lu,%llu,%llu,%ld,%d\n", frame, busy, budget->nmiCycles,
+			budget->latency, !budget->idle);
+	}
+
+	/* still waiting: idle from the start of the next frame */
+	budget->frameStart = end;
+	budget->idleAt = end;
+	budget->nmiCycles = 0;
+	budget->latency = -1;
+}
+
+/*
+ * Starts monitoring the input CPU. csv, when not NULL, gets a row per frame.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+budget_attach(Budget* budget, CPU* cpu, const char* csv)
+{
+	Bus* bus = cpu->bus;
+
+	memset(budget, 0, sizeof(Budget));
+	budget->cpu = cpu;
+	budget->frameStart = bus->frames * FRAME_CYCLES;
+	budget->latency = -1;
+
+	if (csv != NULL) {
+		budget->csv = fopen(csv, "w");
+		if (budget->csv == NULL) {
+			perror(csv);
+			return 0;
+		}
+		fprintf(budget->csv, "frame,busy,nmi,nmi_latency,lag\n");
+	}
+
+	if (!bus_hook(bus, HOOK_EXEC, budget_exec, budget, 0x0000, 0xFFFF)
+		|| !bus_hook(bus, HOOK_IRQ, budget_irq, budget, 0x0000, 0xFFFF)
+		|| !bus_hook(bus, HOOK_FRAME, budget_frame, budget, 0x0000, 0xFFFF)) {
+		fprintf(stderr, "frame budget: too many hooks\n");
+		budget_detach(budget);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Stops monitoring and closes the CSV. */
+void
+budget_detach(Budget* budget)
+{
+	Bus* bus;
+
+	if (budget->cpu == NULL) {
+		return;
+	}
+
+	bus = budget->cpu->bus;
+	bus_unhook(bus, HOOK_EXEC, budget_exec, budget);
+	bus_unhook(bus, HOOK_IRQ, budget_irq, budget);
+	bus_unhook(bus, HOOK_FRAME, budget_frame, budget);
+
+	if (budget->csv != NULL) {
+		fclose(budget->csv);
+		budget->csv = NULL;
+	}
+	budget->cpu = NULL;
+}
+
+/* Copies the totals; safe from any thread. */
+void
+budget_report(Budget* budget, BudgetReport* report)
+{
+	int i;
+
+	report->frames = atomic_load_explicit(&budget->frames, memory_order_relaxed);
+	report->lags = atomic_load_explicit(&budget->lags, memory_order_relaxed);
+	for (i = 0; i < BUDGET_BUCKETS; i++) {
+		report->hist[i] = atomic_load_explicit(&budget->hist[i], memory_order_relaxed);
+	}
+	report->lastBusy = atomic_load_explicit(&budget->lastBusy, memory_order_relaxed);
+	report->lastNmi = atomic_load_explicit(&budget->lastNmi, memory_order_relaxed);
+	report->worstBusy = atomic_load_explicit(&budget->worstBusy, memory_order_relaxed);
+	report->worstNmi = atomic_load_explicit(&budget->worstNmi, memory_order_relaxed);
+	report->worstLatency = atomic_load_explicit(&budget->worstLatency, memory_order_relaxed);
+}
+
+/*
+ * Formats one histogram row, e.g. "40- 50% ######     12",
+ * with the bar scaled to width for the fullest bucket.
+ * returns the length written
+ */
+int
+budget_bar(BudgetReport* report, int bucket, int width, char* out, int size)
+{
+	char bar[81];
+	unsigned long most = 1;
+	int i, len;
+
+	for (i = 0; i < BUDGET_BUCKETS; i++) {
+		if (report->hist[i] > most) {
+			most = report->hist[i];
+		}
+	}
+
+	if (width > 80) {
+		width = 80;
+	}
+	len = report->hist[bucket] * width / most;
+	memset(bar, '#', len);
+	memset(bar + len, ' ', width - len);
+	bar[width] = '\0';
+
+	if (bucket == BUDGET_BUCKETS - 1) {
+		return snprintf(out, size, "    lag %s %5lu", bar, report->hist[bucket]);
+	}
+	return snprintf(out, size, "%2d-%3d%% %s %5lu", bucket * 10, bucket * 10 + 10, bar, report->hist[bucket]);
+}
@@ -0,0 +1,83 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <stdio.h>
+#include <stdatomic.h>
+
+#include "cpu.h"
+
+/*
+ * Frame budget monitor.
+ * Measures per frame how much of the FRAME_CYCLES budget the guest used:
+ *
+ *   busy     cycles from the frame start (vblank) until the main loop
+ *            last entered the wait loop it is in at the frame end
+ *   nmi      cycles spent inside the NMI handler
+ *   latency  cycles from the frame start to NMI handler entry
+ *   lag      the main loop was not waiting when the frame ended, so
+ *            the game missed this vblank
+ *
+ * The wait loop is found by idle-loop detection: a backward branch or
+ * JMP over at most BUDGET_LOOP bytes, taken BUDGET_SPINS times in a row
+ * outside the NMI handler with the registers unchanged between passes
+ * (BIT $2002 / BPL, LDA flag / BEQ, JMP *). Delay loops count registers
+ * down, so they are not mistaken for waiting.
+ *
+ * It runs from exec, interrupt and frame hooks on the emulation thread;
+ * the histogram and totals are atomics any thread can read.
+ */
+#define BUDGET_BUCKETS 11  /* busy share in 10% steps, the last one counts lag frames */
+#define BUDGET_LOOP 16
+#define BUDGET_SPINS 3
+
+typedef struct budget Budget;
+typedef struct budgetReport BudgetReport;
+
+struct budget {
+	CPU* cpu;
+	FILE* csv;
+
+	/* current frame */
+	unsigned long long frameStart;
+	int idle;                        /* spinning in the wait loop */
+	unsigned long long idleAt;
+	int inNmi;
+	unsigned long long nmiAt;        /* entry of the running NMI handler */
+	unsigned long long nmiCycles;
+	unsigned char nmiSp;             /* stack pointer its RTI runs at */
+	long latency;                    /* first NMI entry, -1 without one */
+
+	/* idle loop detection */
+	unsigned short lastPc;
+	unsigned char lastOp;
+	unsigned short loopFrom;         /* the backward branch */
+	unsigned short loopTo;           /* its target */
+	int spins;
+	unsigned long long loopAt;
+	unsigned long long loopRegs;     /* A, X, Y, P, S at the last pass */
+
+	/* totals */
+	atomic_ulong frames;
+	atomic_ulong lags;
+	atomic_ulong hist[BUDGET_BUCKETS];
+	atomic_uint lastBusy;
+	atomic_uint lastNmi;
+	atomic_uint worstBusy;
+	atomic_uint worstNmi;
+	atomic_uint worstLatency;
+};
+
+struct budgetReport {
+	unsigned long frames;
+	unsigned long lags;
+	unsigned long hist[BUDGET_BUCKETS];
+	unsigned int lastBusy, lastNmi;
+	unsigned int worstBusy, worstNmi, worstLatency;
+};
+
+int budget_attach(Budget* budget, CPU* cpu, const char* csv);
+void budget_detach(Budget* budget);
+void budget_report(Budget* budget, BudgetReport* report);
+int budget_bar(BudgetReport* report, int bucket, int width, char* out, int size);
+
+#endif
@@ -1,8 +1,45 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "bus.h"
+#include "trace.h"
+#include "probe.h"
 
 //TODO: init cpu datatype here
 
 
+/* 
+ * Points every page at internal memory, sets up the internal RAM
+ * mirrors and clears it. Must be called once before the bus is used.
+ */
+void
+bus_init(Bus* bus)
+{
+	int i;
+
+	hook_clear(&bus->hooks);
+	sched_init(&bus->sched);
+	bus->frames = 0;
+	bus->perf = NULL;
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		bus->ioRead[i] = NULL;
+		bus->ioWrite[i] = NULL;
+		bus->ioUser[i] = NULL;
+		bus_mapPage(bus, i, &bus->ram[i << PAGE_BITS]);
+	}
+
+	bus_mirror(bus, 0x0000, RAM_SIZE, RAM_MIRROR_END);
+
+	bus->sram = NULL;
+	bus->sramFd = -1;
+
+	bus_clearMem(bus);
+}
+
 void
 bus_clearMem(Bus* bus)
 {
@@ -13,26 +50,288 @@ bus_clearMem(Bus* bus)
 	}
 }
 
+/* 
+ * Points a page at host memory. The fast pointers are only set when
+ * no I/O handler or memory hook covers the page. Hooks are checked
+ * against the page's canonical addresses, so watching internal RAM
+ * traps all of its mirrors.
+ */
+void
+bus_mapPage(Bus* bus, int page, unsigned char* mem)
+{
+	unsigned short lo = BUS_CANONICAL(page << PAGE_BITS);
+	unsigned short hi = lo + PAGE_BYTES - 1;
+
+	bus->page[page] = mem;
+	bus->rpage[page] = (bus->ioRead[page] || hook_covers(&bus->hooks, HOOK_READ, lo, hi)) ? NULL : mem;
+	bus->wpage[page] = (bus->ioWrite[page] || hook_covers(&bus->hooks, HOOK_WRITE, lo, hi)) ? NULL : mem;
+}
+
+/* 
+ * Attaches device register handlers to a page. Either handler may be
+ * NULL, in which case that direction stays plain memory. Handlers get
+ * every address in the page and keep the backing memory for the rest.
+ */
+void
+bus_mapIO(Bus* bus, int page, ioReadFunc read, ioWriteFunc write, void* user)
+{
+	bus->ioRead[page] = read;
+	bus->ioWrite[page] = write;
+	bus->ioUser[page] = user;
+	bus_mapPage(bus, page, bus->page[page]);
+}
+
+/* 
+ * Repeats the pages of start..start+size-1 up to end by pointing the
+ * following pages at the same host memory. Mirrored accesses are then
+ * plain loads and stores with no address masking on the access path.
+ * start, size and end must be page aligned.
+ */
+void
+bus_mirror(Bus* bus, unsigned short start, unsigned short size, unsigned short end)
+{
+	int first = start >> PAGE_BITS;
+	int count = size >> PAGE_BITS;
+	int i;
+
+	for (i = first + count; i < (end >> PAGE_BITS); i++) {
+		bus_mapPage(bus, i, bus->page[first + (i - first) % count]);
+	}
+}
+
+/* Recomputes the fast pointers after the hook set changed. */
+static void
+bus_retrap(Bus* bus)
+{
+	int i;
+
+	for (i = 0; i < PAGE_COUNT; i++) {
+		bus_mapPage(bus, i, bus->page[i]);
+	}
+}
+
 /* writes a input data into the input address 
- * write range is limited to NES's bus range*/
+ * the page table resolves which memory backs the address */
 void
 bus_write(Bus* bus, unsigned short addr, unsigned char data)
 {
-	/* limit writes to NES's range */
-	if (addr >= 0x0000 && addr <= 0xFFFF) {
-		bus->ram[addr] = data;
+	unsigned char* p = bus->wpage[addr >> PAGE_BITS];
+
+	if (p != NULL) {
+		p[addr & (PAGE_BYTES - 1)] = data;
+		return;
+	}
+
+	/* device registers or hooked page */
+	if (bus->ioWrite[addr >> PAGE_BITS] != NULL) {
+		unsigned long long start = bus->perf ? perf_now() : 0;
+
+		bus->ioWrite[addr >> PAGE_BITS](bus->ioUser[addr >> PAGE_BITS], addr, data);
+
+		if (bus->perf) {
+			perf_add(bus->perf, PERF_BUS, start);
+		}
+	} else {
+		bus->page[addr >> PAGE_BITS][addr & (PAGE_BYTES - 1)] = data;
+	}
+
+	if (HOOK_ACTIVE(&bus->hooks, HOOK_WRITE)) {
+		hook_fire(&bus->hooks, HOOK_WRITE, BUS_CANONICAL(addr), data);
 	}
 }
 
 /* read from the bus at input address 
- * read is limited to NES bus range 
- * if attempt to read outside of range
- * this function returns 0x00 */
+ * the page table resolves which memory backs the address */
 unsigned char
 bus_read(Bus* bus, unsigned short addr)
 {
-	if (addr >= 0x0000 && addr <= 0xFFFF) {
-		return bus->ram[addr];
+	unsigned char* p = bus->rpage[addr >> PAGE_BITS];
+	unsigned char data;
+
+	if (p != NULL) {
+		return p[addr & (PAGE_BYTES - 1)];
+	}
+
+	/* device registers or hooked page */
+	if (bus->ioRead[addr >> PAGE_BITS] != NULL) {
+		unsigned long long start = bus->perf ? perf_now() : 0;
+
+		data = bus->ioRead[addr >> PAGE_BITS](bus->ioUser[addr >> PAGE_BITS], addr);
+
+		if (bus->perf) {
+			perf_add(bus->perf, PERF_BUS, start);
+		}
+	} else {
+		data = bus->page[addr >> PAGE_BITS][addr & (PAGE_BYTES - 1)];
 	}
-	return 0x00;
+
+	if (HOOK_ACTIVE(&bus->hooks, HOOK_READ)) {
+		hook_fire(&bus->hooks, HOOK_READ, BUS_CANONICAL(addr), data);
+	}
+	return data;
+}
+
+/* 
+ * reads the bus without side effects
+ * used by debuggers and tools so they never trigger hooks or
+ * device registers (those show the last value written)
+ */
+unsigned char
+bus_peek(Bus* bus, unsigned short addr)
+{
+	return bus->page[addr >> PAGE_BITS][addr & (PAGE_BYTES - 1)];
+}
+
+/* 
+ * Registers a hook. Read and write hooks trap only the pages
+ * their address range covers. They see canonical addresses, so a range
+ * in mirrored RAM is folded onto $0000-$07FF, split in two where it
+ * wraps, and fires for an access through any mirror.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+bus_hook(Bus* bus, HOOK_EVENT ev, hookFunc func, void* user, unsigned short lo, unsigned short hi)
+{
+	unsigned short from[3], to[3];
+	unsigned short end;
+	int n = 0;
+	int i;
+
+	if (ev != HOOK_READ && ev != HOOK_WRITE) {
+		return hook_add(&bus->hooks, ev, func, user, lo, hi);
+	}
+
+	if (lo < RAM_MIRROR_END && lo <= hi) {
+		end = hi < RAM_MIRROR_END ? hi : RAM_MIRROR_END - 1;
+
+		if (end - lo + 1 >= RAM_SIZE) {
+			from[n] = 0x0000;
+			to[n++] = RAM_SIZE - 1;
+		} else if (BUS_CANONICAL(lo) <= BUS_CANONICAL(end)) {
+			from[n] = BUS_CANONICAL(lo);
+			to[n++] = BUS_CANONICAL(end);
+		} else {
+			from[n] = BUS_CANONICAL(lo);
+			to[n++] = RAM_SIZE - 1;
+			from[n] = 0x0000;
+			to[n++] = BUS_CANONICAL(end);
+		}
+		lo = RAM_MIRROR_END;
+	}
+	if (lo <= hi) {
+		from[n] = lo;
+		to[n++] = hi;
+	}
+
+	/* all or nothing */
+	if (bus->hooks.count[ev] + n > HOOK_MAX) {
+		return 0;
+	}
+	for (i = 0; i < n; i++) {
+		hook_add(&bus->hooks, ev, func, user, from[i], to[i]);
+	}
+
+	bus_retrap(bus);
+	return 1;
+}
+
+/* Removes a hook and untraps pages nothing watches anymore. */
+void
+bus_unhook(Bus* bus, HOOK_EVENT ev, hookFunc func, void* user)
+{
+	hook_remove(&bus->hooks, ev, func, user);
+
+	if (ev == HOOK_READ || ev == HOOK_WRITE) {
+		bus_retrap(bus);
+	}
+}
+
+/* 
+ * Backs $6000-$7FFF with a shared mapping of the input save file.
+ * The file is created or extended to SRAM_SIZE if needed. Guest writes
+ * land directly in the page cache, so they stay plain memory stores;
+ * the kernel tracks dirty pages and bus_flushSram() only schedules writeback.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+bus_mapSram(Bus* bus, const char* path)
+{
+	struct stat st;
+	int fd, i;
+	unsigned char* mem;
+
+	fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) {
+		perror(path);
+		return 0;
+	}
+
+	if (fstat(fd, &st) < 0 || (st.st_size < SRAM_SIZE && ftruncate(fd, SRAM_SIZE) < 0)) {
+		perror(path);
+		close(fd);
+		return 0;
+	}
+
+	mem = mmap(NULL, SRAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mem == MAP_FAILED) {
+		perror(path);
+		close(fd);
+		return 0;
+	}
+
+	bus_unmapSram(bus);
+
+	bus->sram = mem;
+	bus->sramFd = fd;
+
+	for (i = 0; i < SRAM_SIZE >> PAGE_BITS; i++) {
+		bus_mapPage(bus, (SRAM_START >> PAGE_BITS) + i, &mem[i << PAGE_BITS]);
+	}
+
+	PROBE1(sram_load, path);
+	return 1;
+}
+
+/* 
+ * Starts asynchronous writeback of dirty save RAM pages.
+ * Never blocks on I/O, so it is safe to call from the main loop on a timer.
+ */
+void
+bus_flushSram(Bus* bus)
+{
+	unsigned long long span = trace_begin();
+
+	if (bus->sram != NULL) {
+		msync(bus->sram, SRAM_SIZE, MS_ASYNC);
+		PROBE1(sram_save, 0);
+		trace_end("sram flush", span);
+	}
+}
+
+/* 
+ * Writes save RAM back synchronously and unmaps it.
+ * The region falls back to internal memory afterwards.
+ */
+void
+bus_unmapSram(Bus* bus)
+{
+	int i;
+
+	if (bus->sram == NULL) {
+		return;
+	}
+
+	msync(bus->sram, SRAM_SIZE, MS_SYNC);
+	PROBE1(sram_save, 1);
+	munmap(bus->sram, SRAM_SIZE);
+	close(bus->sramFd);
+
+	for (i = 0; i < SRAM_SIZE >> PAGE_BITS; i++) {
+		bus_mapPage(bus, (SRAM_START >> PAGE_BITS) + i, &bus->ram[SRAM_START + (i << PAGE_BITS)]);
+	}
+
+	bus->sram = NULL;
+	bus->sramFd = -1;
 }
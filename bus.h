@@ -1,11 +1,83 @@
+#ifndef BUS_H
+#define BUS_H
+
+#include "hook.h"
+#include "sched.h"
+#include "perf.h"
+
 #define MEM_SIZE 64 * 1024
 
+/* 
+ * The address space is split into 256 byte pages. Every page is backed by a
+ * host pointer so regions can be remapped without touching the read/write path.
+ * Pages with I/O handlers or an address-filtered hook get a NULL fast
+ * pointer and take the slow path, so they only slow down their own page.
+ */
+#define PAGE_BITS 8
+#define PAGE_BYTES (1 << PAGE_BITS)
+#define PAGE_COUNT ((MEM_SIZE) >> PAGE_BITS)
+
+/* 2 KB of internal RAM, mirrored four times through $1FFF */
+#define RAM_SIZE 0x0800
+#define RAM_MIRROR_END 0x2000
+
+/* The internal RAM address an access goes to; read/write hooks are matched on it */
+#define BUS_CANONICAL(addr) ((addr) < RAM_MIRROR_END ? (addr) & (RAM_SIZE - 1) : (addr))
+
+/* Battery-backed PRG-RAM on the cartridge ($6000-$7FFF) */
+#define SRAM_START 0x6000
+#define SRAM_SIZE (8 * 1024)
+
 typedef struct bus Bus;
 
+/* Memory mapped I/O handlers */
+typedef unsigned char (*ioReadFunc)(void* user, unsigned short addr);
+typedef void (*ioWriteFunc)(void* user, unsigned short addr, unsigned char data);
+
 struct bus {
 	unsigned char ram[MEM_SIZE];
+	unsigned char* page[PAGE_COUNT];  /* host memory backing each page */
+	unsigned char* rpage[PAGE_COUNT]; /* fast read pointer, NULL if trapped */
+	unsigned char* wpage[PAGE_COUNT]; /* fast write pointer, NULL if trapped */
+
+	/* Device registers */
+	ioReadFunc ioRead[PAGE_COUNT];    /* NULL for plain memory */
+	ioWriteFunc ioWrite[PAGE_COUNT];
+	void* ioUser[PAGE_COUNT];
+
+	/* Tooling callbacks */
+	Hooks hooks;
+
+	/* Timing */
+	Scheduler sched;        /* cycle-timed device events */
+	unsigned long frames;   /* frames completed since power on */
+
+	/* Host timing of device handlers, NULL when not measured */
+	Perf* perf;
+
+	/* Save RAM file mapping */
+	unsigned char* sram; /* NULL when no save file is mapped */
+	int sramFd;
 };
 
+void bus_init(Bus* bus);
 void bus_clearMem(Bus* bus);
 void bus_write(Bus* bus, unsigned short addr, unsigned char data);
 unsigned char bus_read(Bus* bus, unsigned short addr);
+unsigned char bus_peek(Bus* bus, unsigned short addr);
+
+/* Page table */
+void bus_mapPage(Bus* bus, int page, unsigned char* mem);
+void bus_mirror(Bus* bus, unsigned short start, unsigned short size, unsigned short end);
+void bus_mapIO(Bus* bus, int page, ioReadFunc read, ioWriteFunc write, void* user);
+
+/* Hooks */
+int bus_hook(Bus* bus, HOOK_EVENT ev, hookFunc func, void* user, unsigned short lo, unsigned short hi);
+void bus_unhook(Bus* bus, HOOK_EVENT ev, hookFunc func, void* user);
+
+/* Save RAM persistence */
+int bus_mapSram(Bus* bus, const char* path);
+void bus_flushSram(Bus* bus);
+void bus_unmapSram(Bus* bus);
+
+#endif
@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "core.h"
+#include "nsf.h"
+#include "flow.h"
+
+/*
+ * Static control-flow recovery tool.
+ * Finds the code in a program image by following it from its entry
+ * points and writes an annotated listing (labels, basic blocks with
+ * cycle costs, data left as .byte) and optionally a block map for tools
+ * that work on whole blocks.
+ */
+void usage(char* program);
+
+/* macros */
+#define FILL_RUN 16          /* identical data bytes listed as one .fill */
+#define BYTES_PER_ROW 8
+
+/*
+ * Loads the initial banks of an NSF file at $8000 and adds INIT and PLAY
+ * as entry points.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+static int
+loadNsf(Flow* flow, const char* path)
+{
+	Nsf nsf;
+	int i;
+
+	if (!nsf_load(&nsf, path)) {
+		return 0;
+	}
+
+	for (i = 0; i < 8; i++) {
+		if (nsf.banks[i] < nsf.nbanks) {
+			flow_load(flow, 0x8000 + i * NSF_BANK, nsf.image + nsf.banks[i] * NSF_BANK, NSF_BANK);
+		}
+	}
+	flow_entry(flow, nsf.init, FLOW_GIVEN);
+	flow_entry(flow, nsf.play, FLOW_GIVEN);
+
+	nsf_free(&nsf);
+	return 1;
+}
+
+/*
+ * Loads a raw image at base, or ending at $FFFF when base is negative,
+ * and adds the vectors it holds.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+static int
+loadRaw(Flow* flow, const char* path, long base)
+{
+	FILE* file = fopen(path, "rb");
+	unsigned char* data;
+	long size;
+
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	if (size <= 0 || size > MEM_SIZE) {
+		fprintf(stderr, "%s: image must be 1 to %d bytes\n", path, MEM_SIZE);
+		fclose(file);
+		return 0;
+	}
+
+	data = malloc(size);
+	if (data == NULL || fread(data, 1, size, file) != (size_t)size) {
+		fprintf(stderr, "%s: could not read image\n", path);
+		free(data);
+		fclose(file);
+		return 0;
+	}
+	fclose(file);
+
+	if (base < 0) {
+		base = MEM_SIZE - size;
+	}
+	flow_load(flow, base, data, size);
+	flow_vectors(flow);
+
+	free(data);
+	return 1;
+}
+
+/* Loads the built-in program the frontends run. */
+static void
+loadBuiltin(Flow* flow)
+{
+	static Bus bus;
+	static CPU cpu;
+	unsigned char rom[0x8000];
+	int i;
+
+	core_start(&bus, &cpu);
+	for (i = 0; i < 0x8000; i++) {
+		rom[i] = bus_peek(&bus, 0x8000 + i);
+	}
+	flow_load(flow, 0x8000, rom, sizeof(rom));
+	flow_vectors(flow);
+}
+
+/*
+ * Marks every address listed in a coverage file (one hex address per
+ * line, e.g. from an execution trace) as executed.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+static int
+loadCoverage(Flow* flow, const char* path)
+{
+	FILE* file = fopen(path, "r");
+	char line[64];
+	char* hex;
+	char* end;
+	long addr;
+
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), file) != NULL) {
+		hex = line + strspn(line, " \t$");
+		addr = strtol(hex, &end, 16);
+		if (end != hex && addr >= 0 && addr < MEM_SIZE) {
+			flow_entry(flow, addr, FLOW_COVERED);
+		}
+	}
+
+	fclose(file);
+	return 1;
+}
+
+/* Writes the label of addr if it has one. returns 1 if it did */
+static int
+label(Flow* flow, unsigned short addr, char* out, int size)
+{
+	int kind = flow->entry[addr];
+
+	if (kind & FLOW_RESET) {
+		snprintf(out, size, "reset");
+	} else if (kind & FLOW_NMI) {
+		snprintf(out, size, "nmi");
+	} else if (kind & FLOW_IRQ) {
+		snprintf(out, size, "irq");
+	} else if (kind & (FLOW_CALL | FLOW_GIVEN)) {
+		snprintf(out, size, "sub_%04X", addr);
+	} else if (flow->leader[addr] && flow->kind[addr] == FLOW_OPCODE) {
+		snprintf(out, size, "L%04X", addr);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+/* Prints the comment line heading a block. */
+static void
+listBlock(FILE* out, Flow* flow, FLOW_BLOCK* block)
+{
+	fprintf(out, "\n; block $%04X-$%04X, %d instructions, %d cycles",
+		block->start, block->last, block->count, block->cycles);
+	if (block->taken > 0) {
+		fprintf(out, ", +%d taken%s", block->taken, block->taken > 1 ? " (page cross)" : "");
+	}
+	if (block->crossings > 0) {
+		fprintf(out, ", +%d on page crossings", block->crossings);
+	}
+	if (block->dead > 0) {
+		fprintf(out, ", %d dead flag updates", block->dead);
+	}
+	fprintf(out, ", %s", flow_exitName(block->exit));
+	if (block->exit == EXIT_BRANCH || block->exit == EXIT_JUMP || block->exit == EXIT_CALL) {
+		fprintf(out, " $%04X", block->target);
+	}
+	if (block->routine >= 0) {
+		fprintf(out, ", in $%04X", flow->routines[block->routine].entry);
+	}
+	fprintf(out, "\n");
+}
+
+/* Prints the data bytes from addr up to the next code or unloaded byte. returns the end */
+static long
+listData(FILE* out, Flow* flow, long addr)
+{
+	long run, row;
+
+	while (addr < MEM_SIZE && flow->loaded[addr] && flow->kind[addr] == FLOW_DATA) {
+		for (run = 1; addr + run < MEM_SIZE && flow->loaded[addr + run] && flow->kind[addr + run] == FLOW_DATA
+			&& flow->mem[addr + run] == flow->mem[addr]; run++);
+
+		if (run >= FILL_RUN) {
+			fprintf(out, "  $%04lX  .fill %ld, $%02X\n", addr, run, flow->mem[addr]);
+			addr += run;
+			continue;
+		}
+
+		fprintf(out, "  $%04lX  .byte ", addr);
+		for (row = 0; row < BYTES_PER_ROW && addr < MEM_SIZE && flow->loaded[addr] && flow->kind[addr] == FLOW_DATA; row++, addr++) {
+			fprintf(out, "%s$%02X", row > 0 ? ", " : "", flow->mem[addr]);
+		}
+		fprintf(out, "\n");
+	}
+
+	return addr;
+}
+
+/* Prints the annotated listing of every loaded byte. */
+static void
+writeListing(FILE* out, Flow* flow)
+{
+	const INSTRUCTION* ins;
+	char name[16];
+	char text[32];
+	char bytes[16];
+	long addr = 0;
+	int length, i, n;
+
+	while (addr < MEM_SIZE) {
+		if (!flow->loaded[addr]) {
+			addr++;
+			continue;
+		}
+		if (flow->kind[addr] != FLOW_OPCODE) {
+			if (addr == 0 || !flow->loaded[addr - 1]) {
+				fprintf(out, "\n.org $%04lX\n", addr);
+			}
+			addr = listData(out, flow, addr);
+			continue;
+		}
+
+		if (flow->block[addr] >= 0 && flow->blocks[flow->block[addr]].start == addr) {
+			listBlock(out, flow, &flow->blocks[flow->block[addr]]);
+		}
+		if (label(flow, addr, name, sizeof(name))) {
+			fprintf(out, "%s:\n", name);
+		}
+
+		ins = &lookup[flow->mem[addr]];
+		length = flow_length(flow->mem[addr]);
+		for (i = 0, n = 0; i < length; i++) {
+			n += snprintf(bytes + n, sizeof(bytes) - n, "%02X ", flow->mem[(unsigned short)(addr + i)]);
+		}
+		flow_format(flow, addr, text, sizeof(text));
+		fprintf(out, "  $%04lX  %-9s %-16s ; %d", addr, bytes, text, ins->cycles);
+		if (flow->dead[addr]) {
+			fprintf(out, "  dead %s%s%s%s", flow->dead[addr] & N ? "N" : "", flow->dead[addr] & V ? "V" : "",
+				flow->dead[addr] & Z ? "Z" : "", flow->dead[addr] & C ? "C" : "");
+		}
+		fprintf(out, "\n");
+
+		addr += length;
+	}
+}
+
+/*
+ * Writes the block map: a line per block, then a line per routine with
+ * the routines it calls.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+static int
+writeMap(Flow* flow, const char* path)
+{
+	FILE* file = fopen(path, "w");
+	FLOW_BLOCK* block;
+	FLOW_ROUTINE* routine;
+	int i, j;
+
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	fprintf(file, "# block start last next count cycles taken crossings dead exit target routine\n");
+	for (i = 0; i < flow->nblocks; i++) {
+		block = &flow->blocks[i];
+		fprintf(file, "block %04X %04X %04X %d %d %d %d %d %s %04X %d\n", block->start, block->last, block->next,
+			block->count, block->cycles, block->taken, block->crossings, block->dead, flow_exitName(block->exit),
+			block->target, block->routine);
+	}
+
+	fprintf(file, "# routine entry kinds blocks instructions indirect calls...\n");
+	for (i = 0; i < flow->nroutines; i++) {
+		routine = &flow->routines[i];
+		fprintf(file, "routine %04X %d %d %d %d", routine->entry, routine->kinds, routine->blocks,
+			routine->instructions, routine->indirect);
+		for (j = 0; j < routine->ncalls; j++) {
+			fprintf(file, " %04X", routine->calls[j]);
+		}
+		fprintf(file, "\n");
+	}
+
+	if (fclose(file) != 0) {
+		perror(path);
+		return 0;
+	}
+
+	return 1;
+}
+
+/* returns 1 if the file starts with the NSF magic */
+static int
+isNsf(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	char magic[5];
+	int found;
+
+	if (file == NULL) {
+		return 0;
+	}
+	found = fread(magic, 1, 5, file) == 5 && memcmp(magic, "NESM\x1A", 5) == 0;
+	fclose(file);
+
+	return found;
+}
+
+/*
+ * Usage Function
+ * Called when something isn't right with the command line parameters.
+ */
+void
+usage(char* program)
+{
+	printf("Usage: %s \n[--base addr] [--entry addr]... [--coverage file] \n[--map file] [--out file] [image.bin | file.nsf]\n", program);
+}
+
+int
+main(int argc, char* argv[])
+{
+	static Flow flow;
+	FILE* out = stdout;
+	char* outFile = NULL;
+	char* mapFile = NULL;
+	char* coverageFile = NULL;
+	long base = -1;
+	long code = 0;
+	long addr;
+	int ok;
+
+	/* Params for getopt */
+	int ch;
+	int option_index = 0;
+
+	/* Defines the options and their long/short equivalents. */
+	struct option longopts[] = {
+		{ "base", required_argument, NULL, 'b'},
+		{ "entry", required_argument, NULL, 'e'},
+		{ "coverage", required_argument, NULL, 'c'},
+		{ "map", required_argument, NULL, 'm'},
+		{ "out", required_argument, NULL, 'o'},
+		{ "help", no_argument, NULL, 'h'},
+		{ NULL, 0, NULL, 0 }
+	};
+
+	flow_init(&flow);
+
+	/* Processes the command-line parameters */
+	while ((ch = getopt_long(argc, argv, "b:e:c:m:o:h", longopts, &option_index)) != -1) {
+		switch (ch) {
+
+			case 'b':
+				base = strtol(optarg, NULL, 16) & 0xFFFF;
+				break;
+
+			case 'e':
+				flow_entry(&flow, strtol(optarg, NULL, 16) & 0xFFFF, FLOW_GIVEN);
+				break;
+
+			case 'c':
+				coverageFile = optarg;
+				break;
+
+			case 'm':
+				mapFile = optarg;
+				break;
+
+			case 'o':
+				outFile = optarg;
+				break;
+
+			case 'h':
+				printf("Lists the code in a program image, found from its vectors and --entry addresses (hex).\nA raw image ends at $FFFF unless --base is given; an NSF starts from INIT and PLAY.\nWithout an image the built-in program is listed. --coverage adds executed addresses.\n\n");
+				usage(argv[0]);
+				return 0;
+
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		loadBuiltin(&flow);
+		ok = 1;
+	} else if (isNsf(argv[optind])) {
+		ok = loadNsf(&flow, argv[optind]);
+	} else {
+		ok = loadRaw(&flow, argv[optind], base);
+	}
+
+	if (!ok || (coverageFile != NULL && !loadCoverage(&flow, coverageFile))) {
+		return 1;
+	}
+
+	flow_analyze(&flow);
+
+	if (outFile != NULL) {
+		out = fopen(outFile, "w");
+		if (out == NULL) {
+			perror(outFile);
+			return 1;
+		}
+	}
+	writeListing(out, &flow);
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	if (mapFile != NULL && !writeMap(&flow, mapFile)) {
+		return 1;
+	}
+
+	for (addr = 0; addr < MEM_SIZE; addr++) {
+		code += flow.kind[addr] != FLOW_DATA;
+	}
+	fprintf(stderr, "%ld bytes of code, %d blocks, %d routines", code, flow.nblocks, flow.nroutines);
+	if (flow.conflicts > 0 || flow.stops > 0) {
+		fprintf(stderr, ", %d overlapping and %d dead-end paths", flow.conflicts, flow.stops);
+	}
+	fprintf(stderr, "\n");
+
+	return 0;
+}
@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "probe.h"
+
+/* 
+ * Frame end event. Fires the frame hooks and schedules the next frame,
+ * so frames follow guest time exactly whether running or stepping.
+ */
+static void
+core_frameEnd(void* user, unsigned long long when)
+{
+	Bus* bus = user;
+
+	PROBE2(frame_end, bus->frames, when);
+	bus->frames++;
+	PROBE2(frame_start, bus->frames, when);
+
+	if (HOOK_ACTIVE(&bus->hooks, HOOK_FRAME)) {
+		hook_fire(&bus->hooks, HOOK_FRAME, 0, 0);
+	}
+
+	sched_add(&bus->sched, when + FRAME_CYCLES, core_frameEnd, bus);
+}
+
+/* 
+ * Powers on a bare machine: initializes the bus, attaches the CPU
+ * and starts the frame timer. Programs are loaded after this.
+ */
+void
+core_init(Bus* bus, CPU* cpu)
+{
+	bus_init(bus);
+	cpu->bus = bus;
+	cpu->clocks = 0;
+	cpu->instructions = 0;
+	cpu->prof = NULL;
+
+	sched_add(&bus->sched, FRAME_CYCLES, core_frameEnd, bus);
+}
+
+/* 
+ * Copies a program given as space separated hex bytes into memory.
+ * returns the number of bytes loaded
+ */
+int
+core_load(Bus* bus, unsigned short addr, const char* hex)
+{
+	char* source = strdup(hex);
+	char* ss = source;
+	char* hex_str;
+	int count = 0;
+
+	if (source == NULL) {
+		return 0;
+	}
+
+	while ((hex_str = strsep(&ss, " ")) != NULL) {
+		if (*hex_str == '\0') {
+			continue;
+		}
+		bus->page[addr >> PAGE_BITS][addr & (PAGE_BYTES - 1)] = strtol(hex_str, NULL, 16);
+		addr++;
+		count++;
+	}
+	free(source);
+
+	return count;
+}
+
+/* 
+ * Initializes the bus, loads the built-in program at $8000
+ * and resets the CPU into it.
+ */
+void
+core_start(Bus* bus, CPU* cpu)
+{
+	core_init(bus, cpu);
+
+	/* assembled at https://www.masswerk.at/6502/assembler.html) */
+	/*
+ 		; FIBONACCI SEQUENCE GENERATOR
+ 		LDA  #0
+      		STA  $F0     ; LOWER NUMBER
+       		LDA  #1
+       		STA  $F1     ; HIGHER NUMBER
+       		LDX  #0
+	 LOOP:  LDA  $F1
+       		STA  $0F1B,X
+       		STA  $F2     ; OLD HIGHER NUMBER
+       		ADC  $F0
+       		STA  $F1     ; NEW HIGHER NUMBER
+       		LDA  $F2
+       		STA  $F0     ; NEW LOWER NUMBER
+       		INX
+       		CPX  #$0A    ; STOP AT FIB(10)
+       		BMI  LOOP
+       		RTS          ; RETURN FROM SUBROUTINE
+	*/
+	core_load(bus, 0x8000, "A9 00 8D F0 00 A9 01 8D F1 00 A2 00 AD F1 00 9D 1B 0F 8D F2 00 6D F0 00 8D F1 00 AD F2 00 8D F0 00 E8 E0 0A 30 E6 60");
+
+	/* set reset vectors */
+	bus->ram[0xFFFC] = 0x00;
+	bus->ram[0xFFFD] = 0x80;
+
+	cpu_reset(cpu);
+}
+
+/* 
+ * Clocks the CPU through one whole instruction.
+ * returns the number of cycles it took
+ */
+int
+core_step(CPU* cpu)
+{
+	int cycles = 0;
+
+	do {
+		cpu_clock(cpu);
+		cycles++;
+	} while (cpu->cycles != 0);
+
+	/* devices are only looked at when one of their events is due */
+	if (cpu->clocks >= cpu->bus->sched.next) {
+		sched_run(&cpu->bus->sched, cpu->clocks);
+	}
+
+	return cycles;
+}
+
+/* 
+ * Runs whole instructions until at least the input number of cycles elapsed.
+ * returns the number of cycles run
+ */
+int
+core_run(CPU* cpu, int cycles)
+{
+	int ran = 0;
+
+	while (ran < cycles) {
+		ran += core_step(cpu);
+	}
+
+	return ran;
+}
+
+/* 
+ * Runs whole instructions until the current frame ends.
+ * returns the number of cycles run
+ */
+int
+core_frame(CPU* cpu)
+{
+	unsigned long frame = cpu->bus->frames;
+	int ran = 0;
+
+	while (cpu->bus->frames == frame) {
+		ran += core_step(cpu);
+	}
+
+	return ran;
+}
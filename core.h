@@ -0,0 +1,20 @@
+#ifndef CORE_H
+#define CORE_H
+
+#include "cpu.h"
+
+/*
+ * Emulator core shared by the frontends.
+ * Owns program loading and the run loop so the SDL and terminal
+ * frontends only deal with drawing and input.
+ */
+#define FRAME_CYCLES 29780 /* NTSC CPU cycles per video frame */
+
+void core_init(Bus* bus, CPU* cpu);
+int core_load(Bus* bus, unsigned short addr, const char* hex);
+void core_start(Bus* bus, CPU* cpu);
+int core_step(CPU* cpu);
+int core_run(CPU* cpu, int cycles);
+int core_frame(CPU* cpu);
+
+#endif
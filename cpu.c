@@ -1,4 +1,7 @@
+#include <string.h>
+
 #include "cpu.h"
+#include "probe.h"
 
 # define UNUSED(x) (void)(x)
 
@@ -20,17 +23,50 @@ cpu_write(CPU* cpu, unsigned short addr, unsigned char byte)
 	bus_write(cpu->bus, addr, byte);
 }
 
+/*
+ * Reads instruction byte n (1 or 2) of the current instruction; pc must
+ * point at it. Uses the bytes fetched with the opcode when there are some.
+ */
+static unsigned char
+cpu_operand(CPU* cpu, int n)
+{
+	return cpu->prefetched ? cpu->prefetch[n] : cpu_read(cpu, cpu->pc);
+}
+
 /*
  * Cycles the clock. If there are no cycles left in the current instruction
  * it will read the next instruction in the program, setting the current 
  * opcode in the CPU.
+ *
+ * When the instruction lies in a page with a fast read pointer (plain
+ * memory, no device or read hook) and can not run past its end, the
+ * opcode and operand bytes are loaded together in one 4 byte read.
+ * Otherwise every byte goes through the bus.
  */
 void
 cpu_clock(CPU* cpu) 
 {
 	if (cpu->cycles == 0) {
-		cpu->opcode = cpu_read(cpu, cpu->pc);
+		if (HOOK_ACTIVE(&cpu->bus->hooks, HOOK_EXEC)) {
+			hook_fire(&cpu->bus->hooks, HOOK_EXEC, cpu->pc, bus_peek(cpu->bus, cpu->pc));
+		}
+
+		unsigned char* page = cpu->bus->rpage[cpu->pc >> PAGE_BITS];
+
+		if (page != NULL && (cpu->pc & (PAGE_BYTES - 1)) <= PAGE_BYTES - 4) {
+			memcpy(cpu->prefetch, page + (cpu->pc & (PAGE_BYTES - 1)), 4);
+			cpu->opcode = cpu->prefetch[0];
+			cpu->prefetched = true;
+		} else {
+			cpu->opcode = cpu_read(cpu, cpu->pc);
+			cpu->prefetched = false;
+		}
 		cpu->pc++;
+		cpu->instructions++;
+
+		if ((cpu->instructions & (PROBE_SAMPLE - 1)) == 0) {
+			PROBE3(insn, cpu->pc - 1, cpu->opcode, cpu->clocks);
+		}
 	
 		cpu->cycles = lookup[cpu->opcode].cycles;
 		
@@ -44,6 +80,7 @@ cpu_clock(CPU* cpu)
 		cpu->cycles += (cycleCheck1 & cycleCheck2);
 	}
 
+	cpu->clocks++;
 	cpu->cycles--;
 }
 
@@ -63,12 +100,77 @@ cpu_reset(CPU* cpu)
 	cpu->x = 0;
 	cpu->y = 0;
 	cpu->stkp = 0xFD;
-	cpu->status = 0x00 | U;
+	cpu->status = 0x00 | U | I;   /* reset masks IRQs, like the 6502 */
 
 	cpu->addr_rel = 0x0000;
 	cpu->addr_abs = 0x0000;
 	cpu->fetched = 0x00;
+	cpu->prefetched = false;
+
+	cpu->cycles = 8;
+}
+
+/* 
+ * Pushes the program counter and status register to the stack
+ * and jumps through the input vector.
+ */
+static void
+cpu_interrupt(CPU* cpu, unsigned short vector)
+{
+	unsigned short lo, hi;
+	unsigned char pushed;
+
+	cpu_write(cpu, 0x0100 + cpu->stkp, (cpu->pc >> 8) & 0x00FF);
+	cpu->stkp--;
+	cpu_write(cpu, 0x0100 + cpu->stkp, cpu->pc & 0x00FF);
+	cpu->stkp--;
+
+	/* I is set after the push so RTI restores the interrupted code's mask */
+	pushed = (cpu->status & ~B) | U;
+	cpu_write(cpu, 0x0100 + cpu->stkp, pushed);
+	cpu->stkp--;
+
+	cpu_setFlag(cpu, B, 0);
+	cpu_setFlag(cpu, U, 1);
+	cpu_setFlag(cpu, I, 1);
+
+	PROBE2(irq, vector, cpu->pc);
+
+	if (HOOK_ACTIVE(&cpu->bus->hooks, HOOK_IRQ)) {
+		hook_fire(&cpu->bus->hooks, HOOK_IRQ, vector, pushed);
+	}
+
+	cpu->addr_abs = vector;
+	lo = cpu_read(cpu, cpu->addr_abs + 0);
+	hi = cpu_read(cpu, cpu->addr_abs + 1);
+	cpu->pc = (hi << 8) | lo;
 
+	if (cpu->prof != NULL) {
+		prof_call(cpu->prof, vector == 0xFFFA ? PROF_NMI : PROF_IRQ, cpu->pc, cpu->stkp + 3, cpu->clocks);
+	}
+}
+
+/* 
+ * Interrupt request. Ignored while the interrupt disable flag is set.
+ * Should be raised between instructions (cycles == 0).
+ */
+void
+cpu_irq(CPU* cpu)
+{
+	if (cpu_getFlag(cpu, I) == 0) {
+		cpu_interrupt(cpu, 0xFFFE);
+		cpu->cycles = 7;
+	}
+}
+
+/* 
+ * Non-maskable interrupt request. Always taken.
+ * Should be raised between instructions (cycles == 0).
+ */
+void
+cpu_nmi(CPU* cpu)
+{
+	cpu_interrupt(cpu, 0xFFFA);
 	cpu->cycles = 8;
 }
 
@@ -138,7 +240,7 @@ unsigned char
 ZP0(CPU* cpu)
 {
 	
-	cpu->addr_abs = cpu_read(cpu, cpu->pc);
+	cpu->addr_abs = cpu_operand(cpu, 1);
 	cpu->pc++;
 	cpu->addr_abs = cpu->addr_abs & 0x00FF;
 	return 0;
@@ -152,7 +254,7 @@ ZP0(CPU* cpu)
 unsigned char
 ZPX(CPU* cpu)
 {
-	cpu->addr_abs = cpu_read(cpu, cpu->pc + cpu->x);
+	cpu->addr_abs = cpu_operand(cpu, 1) + cpu->x;
 	cpu->pc++;
 	cpu->addr_abs = cpu->addr_abs & 0x00FF;
 	return 0;
@@ -165,7 +267,7 @@ ZPX(CPU* cpu)
 unsigned char
 ZPY(CPU* cpu)
 {
-	cpu->addr_abs = cpu_read(cpu, cpu->pc + cpu->y);
+	cpu->addr_abs = cpu_operand(cpu, 1) + cpu->y;
 	cpu->pc++;
 	cpu->addr_abs = cpu->addr_abs & 0x00FF;
 	return 0;
@@ -178,7 +280,7 @@ ZPY(CPU* cpu)
 unsigned char
 REL(CPU* cpu)
 {
-	cpu->addr_rel = cpu_read(cpu, cpu->pc);
+	cpu->addr_rel = cpu_operand(cpu, 1);
 	cpu->pc++;
 	/* the address must be within -128 and 128
  	   you cannot branch to any address with the 6502 */
@@ -199,9 +301,9 @@ ABS(CPU* cpu)
 {
 	unsigned char hi, lo;
 
-	lo = cpu_read(cpu, cpu->pc);
+	lo = cpu_operand(cpu, 1);
 	cpu->pc++;
-	hi = cpu_read(cpu, cpu->pc);
+	hi = cpu_operand(cpu, 2);
 	cpu->pc++;
 
 	cpu->addr_abs = (hi << 8) | lo;
@@ -219,9 +321,9 @@ ABX(CPU* cpu)
 {
 	unsigned short lo, hi;
 
-	lo = cpu_read(cpu, cpu->pc);
+	lo = cpu_operand(cpu, 1);
 	cpu->pc++;
-	hi = cpu_read(cpu, cpu->pc);
+	hi = cpu_operand(cpu, 2);
 	cpu->pc++;
 
 	cpu->addr_abs = (hi << 8) | lo;
@@ -243,9 +345,9 @@ ABY(CPU* cpu)
 {
 	unsigned short lo, hi;
 
-	lo = cpu_read(cpu, cpu->pc);
+	lo = cpu_operand(cpu, 1);
 	cpu->pc++;
-	hi = cpu_read(cpu, cpu->pc);
+	hi = cpu_operand(cpu, 2);
 	cpu->pc++;
 
 	cpu->addr_abs = (hi << 8) | lo;
@@ -274,9 +376,9 @@ IND(CPU* cpu)
 {
 	unsigned short p_lo, p_hi, p;
 
-	p_lo = cpu_read(cpu, cpu->pc);
+	p_lo = cpu_operand(cpu, 1);
 	cpu->pc++;
-	p_hi = cpu_read(cpu, cpu->pc);
+	p_hi = cpu_operand(cpu, 2);
 	cpu->pc++;
 
 	p = (p_hi << 8) | p_lo;
@@ -300,7 +402,7 @@ IZX(CPU* cpu)
 {
 	unsigned short t, lo, hi;
 	
-	t = cpu_read(cpu, cpu->pc);
+	t = cpu_operand(cpu, 1);
 	cpu->pc++;
 
 	lo = cpu_read(cpu, (unsigned short)(t + (unsigned short)(cpu->x + 0)) & 0x00FF);
@@ -322,11 +424,11 @@ IZY(CPU* cpu)
 {
 	unsigned short t, lo, hi;
 
-	t = cpu_read(cpu, cpu->pc);
+	t = cpu_operand(cpu, 1);
 	cpu->pc++;
 
-	lo = cpu_read(cpu, (unsigned short)(t + (unsigned short)(cpu->x + 0)) & 0x00FF);
-	hi = cpu_read(cpu, (unsigned short)(t + (unsigned short)(cpu->x + 1)) & 0x00FF);
+	lo = cpu_read(cpu, t & 0x00FF);
+	hi = cpu_read(cpu, (t + 1) & 0x00FF);
 
 	cpu->addr_abs = (hi << 8) | lo;
 	cpu->addr_abs += cpu->y;
@@ -594,6 +696,10 @@ BRK(CPU* cpu) {
 
 	cpu->pc = ((unsigned short)cpu_read(cpu, 0xFFFE) | ((unsigned short)cpu_read(cpu, 0xFFFF) << 8));
 
+	if (cpu->prof != NULL) {
+		prof_call(cpu->prof, PROF_IRQ, cpu->pc, cpu->stkp + 3, cpu->clocks);
+	}
+
 	return 0;
 }
 
@@ -873,6 +979,10 @@ JSR(CPU* cpu) {
 
 	cpu->pc = cpu->addr_abs;
 
+	if (cpu->prof != NULL) {
+		prof_call(cpu->prof, PROF_CALL, cpu->pc, cpu->stkp + 2, cpu->clocks);
+	}
+
 	return 0;
 }
 
@@ -1089,6 +1199,10 @@ RTI(CPU* cpu)
 	cpu->pc = (unsigned short)cpu_read(cpu, 0x0100 + cpu->stkp);
 	cpu->stkp++;
 	cpu->pc = cpu->pc | (unsigned short)cpu_read(cpu, 0x0100 + cpu->stkp) << 8;
+
+	if (cpu->prof != NULL) {
+		prof_return(cpu->prof, cpu->stkp, cpu->clocks);
+	}
 	return 0;
 }
 
@@ -1101,6 +1215,10 @@ RTS(CPU* cpu)
 	cpu->stkp++;
 	cpu->pc = cpu->pc | (unsigned short)cpu_read(cpu, 0x0100 + cpu->stkp) << 8;
 	cpu->pc++;
+
+	if (cpu->prof != NULL) {
+		prof_return(cpu->prof, cpu->stkp, cpu->clocks);
+	}
 	return 0;
 }
 
@@ -1289,3 +1407,12 @@ cpu_getOpcode(CPU* cpu)
 {
 	return lookup[cpu->opcode].name;
 }
+
+/*
+ * returns the name of the input opcode
+ */
+char*
+cpu_getOpcodeName(unsigned char opcode)
+{
+	return lookup[opcode].name;
+}
@@ -1,5 +1,9 @@
+#ifndef CPU_H
+#define CPU_H
+
 #include <stdbool.h>
 #include "bus.h"
+#include "prof.h"
 
 /* Enumeration of flags for the status register. */
 typedef enum statusFlags STATUS_FLAG;
@@ -37,6 +41,15 @@ struct cpu {
 	unsigned short addr_rel; /* Relative address in page */
 	unsigned char opcode;    /* Current operation */
 	unsigned char cycles;    /* Number of clock cycles the opcode takes */
+
+	/* Instruction bytes loaded with one read, when they sit in one plain memory page */
+	unsigned char prefetch[4]; /* opcode and the three bytes after it */
+	bool prefetched;           /* operands come from prefetch, not the bus */
+
+	unsigned long long clocks; /* Clock cycles since power on */
+	unsigned long long instructions; /* Instructions started since power on */
+
+	Prof* prof;                /* call profiler, NULL when off */
 };
 
 /* Instruction Structure */
@@ -47,6 +60,9 @@ struct instruction {
 	unsigned char cycles;           /* Number of cycles for instruction */
 };
 
+/* Instruction table, indexed by opcode */
+extern INSTRUCTION lookup[256];
+
 /* Helper functions to interact with the status register. */
 unsigned char cpu_getFlag(CPU* cpu, STATUS_FLAG f);
 void cpu_setFlag(CPU* cpu, STATUS_FLAG f, bool set);
@@ -98,3 +114,10 @@ unsigned char XXX(CPU* cpu);
  * retuns the name of the current opcode
  */
 char* cpu_getOpcode(CPU* cpu);
+
+/*
+ * returns the name of the input opcode
+ */
+char* cpu_getOpcodeName(unsigned char opcode);
+
+#endif
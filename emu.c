@@ -3,20 +3,41 @@
 #include <SDL.h>
 #include <SDL_ttf.h>
 #include <getopt.h>
+#include <stdatomic.h>
 
-#include "cpu.h"
+#include "core.h"
+#include "script.h"
+#include "export.h"
+#include "apu.h"
+#include "perf.h"
+#include "trace.h"
+#include "budget.h"
 
 int startSDL();
 void closeSDL();
 void startEmu();
+int emulate(void* data);
 void drawMemory();
 void drawString();
+void loadGlyphs();
+void startAudio();
+void audioCallback(void* user, Uint8* stream, int len);
+void drawPerf(PerfReport* report);
+void drawBudget();
 void usage(char* program);
 
 /* macros */
 #define TITLE "6502 Emulator"
 #define WIDTH 960
 #define HEIGHT 720
+#define SRAM_FLUSH_MS 1000 /* interval between save RAM writebacks */
+#define FRAME_RATE 60      /* emulated frames per second while running */
+#define GLYPHS 128         /* ASCII characters cached as textures */
+#define AUDIO_SAMPLES 512  /* device buffer, ~12 ms */
+#define AUDIO_TARGET 1024  /* samples kept queued in the APU ring, ~23 ms */
+#define AUDIO_GAIN 5       /* rate adjustment in ppm per sample off target */
+#define MAX_SKIP 4         /* consecutive frames left undisplayed when behind */
+#define SPEED_MS 500       /* speed readout update interval */
 
 /* Variables */
 SDL_Window* window = NULL;
@@ -25,11 +46,50 @@ Bus nes;
 CPU cpu_descriptor;
 CPU* cpu;
 TTF_Font* font = NULL;
-SDL_Surface* string = NULL;
 SDL_Color fontColor = {0x00, 0x00, 0xFF, 0xFF};
-SDL_Texture* stringTexture = NULL;
+SDL_Texture* glyph[GLYPHS];  /* one texture per character, rendered once */
+int glyphW[GLYPHS];
+int glyphH[GLYPHS];
+char hexByte[256][3];        /* "00" to "FF" */
 char* viewport1;
 char* viewport2;
+Script script;
+Export shared;
+
+/*
+ * The CPU runs on its own thread and publishes a snapshot at every frame
+ * end (or step). The UI thread renders the newest snapshot, so drawing
+ * trails the CPU by up to a frame and never stalls emulation.
+ */
+SDL_Thread* emuThread = NULL;
+atomic_int running;   /* run continuously */
+atomic_int steps;     /* single steps requested by the UI */
+atomic_int quitting;  /* asks the emulation thread to exit */
+atomic_int fastForward; /* held key, unthrottled */
+atomic_int turbo;       /* toggled, unthrottled */
+atomic_ulong emulated;  /* frames run */
+atomic_ulong skipped;   /* frames run but never published */
+int displayRate = FRAME_RATE;
+
+/* Host timing, measured only with --perf */
+Perf perf;
+int measure = 0;
+int showPerf = 0;
+
+/* Frame budget monitor, only with --budget */
+Budget budget;
+int monitor = 0;
+ExportRegs viewRegs;
+unsigned char viewRam[MEM_SIZE];
+
+/*
+ * Audio is synthesized on the APU thread into a lock-free ring that the
+ * SDL callback drains. The callback never blocks; it steers the APU
+ * output rate slightly to keep the ring near AUDIO_TARGET, which absorbs
+ * the drift between the frame pacing clock and the sound card clock.
+ */
+Apu apu;
+SDL_AudioDeviceID audioDev = 0;
 
 /* 
  * starts the SDL system for graphics
@@ -39,8 +99,10 @@ char* viewport2;
 int
 startSDL()
 {
+	SDL_DisplayMode mode;
+
 	/* Initialize SDL */
-	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
 		fprintf(stderr, "SDL could not initialize! SDL_Error: %s\n", SDL_GetError());
 		return 0;
 	}
@@ -59,7 +121,7 @@ startSDL()
 	}
 
 	/* create renderer */
-	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+	renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	if (renderer == NULL) {
 		fprintf(stderr, "Renderer could not be created! SDL_Error:%s\n", SDL_GetError());
 		return 0;
@@ -74,6 +136,13 @@ startSDL()
 		printf("Could not load font! TTF_Error: %s\n", TTF_GetError());
 	}
 
+	loadGlyphs();
+
+	/* fast forward publishes no more frames than the display shows */
+	if (SDL_GetCurrentDisplayMode(SDL_GetWindowDisplayIndex(window), &mode) == 0 && mode.refresh_rate > 0) {
+		displayRate = mode.refresh_rate;
+	}
+
 	/* set initial color */
 	SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
 
@@ -86,6 +155,13 @@ startSDL()
 void
 closeSDL()
 {
+	for (int i = 0; i < GLYPHS; i++) {
+		if (glyph[i] != NULL) {
+			SDL_DestroyTexture(glyph[i]);
+			glyph[i] = NULL;
+		}
+	}
+
 	SDL_DestroyWindow(window);
 	SDL_DestroyRenderer(renderer);
 	renderer= NULL;
@@ -101,70 +177,209 @@ closeSDL()
 void
 startEmu()
 {
-	
-
-	bus_clearMem(&nes);
 	cpu = &cpu_descriptor;
-	cpu->bus = &nes;
+	core_start(&nes, cpu);
+}
 
-	
-	/* assembled at https://www.masswerk.at/6502/assembler.html) */
-	/*
- 		; FIBONACCI SEQUENCE GENERATOR
- 		LDA  #0
-      		STA  $F0     ; LOWER NUMBER
-       		LDA  #1
-       		STA  $F1     ; HIGHER NUMBER
-       		LDX  #0
-	 LOOP:  LDA  $F1
-       		STA  $0F1B,X
-       		STA  $F2     ; OLD HIGHER NUMBER
-       		ADC  $F0
-       		STA  $F1     ; NEW HIGHER NUMBER
-       		LDA  $F2
-       		STA  $F0     ; NEW LOWER NUMBER
-       		INX
-       		CPX  #$0A    ; STOP AT FIB(10)
-       		BMI  LOOP
-       		RTS          ; RETURN FROM SUBROUTINE
-	*/
-	char* ss = strdup("A9 00 8D F0 00 A9 01 8D F1 00 A2 00 AD F1 00 9D 1B 0F 8D F2 00 6D F0 00 8D F1 00 AD F2 00 8D F0 00 E8 E0 0A 30 E6 60");
-	unsigned short nOffset = 0x8000;
-	char* hex_str;
-	unsigned char value;
-	while ((hex_str = strsep(&ss, " ")) != NULL) {
-		value = strtol(hex_str, NULL, 16);
-		nes.ram[nOffset++] = value;
-	}
-
-	/* set reset vectors */
-	nes.ram[0xFFFC] = 0x00;
-	nes.ram[0xFFFD] = 0x80;
-
-	cpu_reset(cpu);
+/*
+ * attaches the APU and opens the audio device
+ * runs silently if there is no audio device
+ */
+void
+startAudio()
+{
+	SDL_AudioSpec want, have;
+
+	if (!apu_init(&apu, cpu, 1)) {
+		fprintf(stderr, "APU could not be attached, continuing without audio.\n");
+		return;
+	}
+
+	SDL_zero(want);
+	want.freq = APU_RATE;
+	want.format = AUDIO_S16SYS;
+	want.channels = 1;
+	want.samples = AUDIO_SAMPLES;
+	want.callback = audioCallback;
+	want.userdata = &apu;
+
+	audioDev = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+	if (audioDev == 0) {
+		fprintf(stderr, "Audio device could not be opened! SDL_Error: %s\n", SDL_GetError());
+		return;
+	}
+
+	SDL_PauseAudioDevice(audioDev, 0);
 }
 
+/*
+ * SDL audio thread. Takes what the APU has ready, holds the last sample
+ * through underruns, and adjusts the APU rate from the smoothed ring level.
+ */
 void
-drawMemory()
+audioCallback(void* user, Uint8* stream, int len)
 {
+	static short last = 0;
+	static int level = AUDIO_TARGET;
+	short* out = (short*)stream;
+	int want = len / (int)sizeof(short);
+	unsigned long long span = trace_begin();
+	int n;
+
+	trace_thread("audio");
+
+	/* fast forward overfills the ring; drop the backlog instead of lagging */
+	while (apu_buffered(user) > AUDIO_TARGET * 4) {
+		apu_samples(user, out, want);
+		level = AUDIO_TARGET;
+	}
+
+	n = apu_samples(user, out, want);
+	if (n > 0) {
+		last = out[n - 1];
+	}
+	for (; n < want; n++) {
+		out[n] = last;
+	}
 
-	char* temp = malloc (sizeof(char) * 3);
+	level += (apu_buffered(user) - level) / 8;
+	apu_setRate(user, (level - AUDIO_TARGET) * AUDIO_GAIN);
+
+	trace_end("audio callback", span);
+}
+
+/*
+ * Emulation thread.
+ * Runs a frame per 1/FRAME_RATE seconds while running, or single steps
+ * on request. The frame hook publishes the snapshot.
+ *
+ * Fast forward and turbo run unthrottled and only publish as many
+ * frames as the display refreshes; the rest are render-skipped. At
+ * normal speed, frames that start behind real time are not published
+ * either (up to MAX_SKIP in a row) so the emulator can catch up. Only
+ * after MAX_SKIP skips in a row is the rest of the deficit given up.
+ */
+int
+emulate(void* data)
+{
+	Uint64 freq = SDL_GetPerformanceFrequency();
+	Uint64 next = SDL_GetPerformanceCounter();
+	Uint64 shown = next;
+	Uint64 now;
+	unsigned long long start;
+	unsigned long long span;
+	int fast;
+	int behind = 0;
+
+	(void)data;
+
+	trace_thread("emulation");
+
+	while (!atomic_load(&quitting)) {
+		if (atomic_load(&running)) {
+			fast = atomic_load(&fastForward) || atomic_load(&turbo);
+			now = SDL_GetPerformanceCounter();
+
+			if (fast) {
+				shared.hold = 1;
+			} else {
+				/* late by more than half a frame, so a delay overshoot is not counted */
+				behind = (now > next + freq / FRAME_RATE / 2 && behind < MAX_SKIP) ? behind + 1 : 0;
+				shared.hold = behind > 0;
+			}
+
+			start = measure ? perf_now() : 0;
+			span = trace_begin();
+			core_frame(cpu);
+			trace_end("frame", span);
+			atomic_fetch_add(&emulated, 1);
+			if (measure) {
+				perf_frame(&perf, start, cpu->clocks, cpu->instructions);
+			}
 
+			now = SDL_GetPerformanceCounter();
+			if (fast && now - shown >= freq / displayRate) {
+				export_publish(&shared);
+				shown = now;
+			} else if (shared.hold) {
+				atomic_fetch_add(&skipped, 1);
+			}
+			shared.hold = 0;
+
+			if (fast) {
+				next = now;
+				continue;
+			}
+
+			/* pace to real time */
+			next += freq / FRAME_RATE;
+			if (next > now) {
+				SDL_Delay((next - now) * 1000 / freq);
+			} else if (behind == MAX_SKIP) {
+				next = now;
+			}
+		} else if (atomic_load(&steps) > 0) {
+			atomic_fetch_sub(&steps, 1);
+			span = trace_begin();
+			core_step(cpu);
+			trace_end("step", span);
+			export_publish(&shared);
+		} else {
+			SDL_Delay(1);
+			next = SDL_GetPerformanceCounter();
+		}
+	}
+
+	return 0;
+}
+
+/* 
+ * Rasterizes every printable character once so drawing text is only
+ * texture copies. Rendering each string through TTF and uploading a new
+ * texture every frame used to dominate frame time.
+ */
+void
+loadGlyphs()
+{
+	char chars[2] = {0, 0};
+	SDL_Surface* surface;
+
+	for (int i = 0; i < 256; i++) {
+		sprintf(hexByte[i], "%02X", i);
+	}
+
+	if (font == NULL) {
+		return;
+	}
+
+	for (int i = ' '; i < GLYPHS - 1; i++) {
+		chars[0] = i;
+		TTF_SizeText(font, chars, &glyphW[i], &glyphH[i]);
+
+		/* blank glyphs (space) only advance */
+		surface = TTF_RenderText_Solid(font, chars, fontColor);
+		if (surface == NULL) {
+			continue;
+		}
+
+		glyph[i] = SDL_CreateTextureFromSurface(renderer, surface);
+		SDL_FreeSurface(surface);
+	}
+}
+
+void
+drawMemory()
+{
 	int a = strtol(viewport1+2, NULL, 16);
 	int b = strtol(viewport2+2, NULL, 16);
 
 	for(int i = 0; i < 16*16; i++) {
-		sprintf(temp, "%02X", nes.ram[i + a]);
-		drawString((i%16) * 30, (i/16) * 20, temp);
+		drawString((i%16) * 30, (i/16) * 20, hexByte[viewRam[(unsigned short)(i + a)]]);
 	}
 
 	for(int i = 0; i < 16*16; i++) {
-		sprintf(temp, "%02X", nes.ram[i + b]);
-		drawString((i%16) * 30, ((i/16) * 20)+350, temp);
+		drawString((i%16) * 30, ((i/16) * 20)+350, hexByte[viewRam[(unsigned short)(i + b)]]);
 	}
-
-	free(temp);
-
 }
 
 void
@@ -174,48 +389,104 @@ drawCPU()
 	int x = 500;
 	int y = 0;
 	drawString(x, y, "STATUS:");
-	drawString(x + 100, y, (cpu->status&N)? "N":"-");
-	drawString(x + 140, y, (cpu->status&V)? "V":"-");
-	drawString(x + 180, y, (cpu->status&U)? "-":"-");
-	drawString(x + 220, y, (cpu->status&B)? "B":"-");
-	drawString(x + 260, y, (cpu->status&D)? "D":"-");
-	drawString(x + 300, y, (cpu->status&I)? "I":"-");
-	drawString(x + 340, y, (cpu->status&Z)? "Z":"-");
-	drawString(x + 380, y, (cpu->status&C)? "C":"-");
-	sprintf(buff, "PC: $%04X", cpu->pc);
+	drawString(x + 100, y, (viewRegs.status&N)? "N":"-");
+	drawString(x + 140, y, (viewRegs.status&V)? "V":"-");
+	drawString(x + 180, y, (viewRegs.status&U)? "-":"-");
+	drawString(x + 220, y, (viewRegs.status&B)? "B":"-");
+	drawString(x + 260, y, (viewRegs.status&D)? "D":"-");
+	drawString(x + 300, y, (viewRegs.status&I)? "I":"-");
+	drawString(x + 340, y, (viewRegs.status&Z)? "Z":"-");
+	drawString(x + 380, y, (viewRegs.status&C)? "C":"-");
+	sprintf(buff, "PC: $%04X", viewRegs.pc);
 	drawString(x, y + 20, buff);
-	sprintf(buff, "A: $%04X", cpu->a);
+	sprintf(buff, "A: $%04X", viewRegs.a);
 	drawString(x, y + 40, buff);
-	sprintf(buff, "X: $%04X", cpu->x);
+	sprintf(buff, "X: $%04X", viewRegs.x);
 	drawString(x, y + 60, buff);
-	sprintf(buff, "Y: $%04X", cpu->y);
+	sprintf(buff, "Y: $%04X", viewRegs.y);
 	drawString(x, y + 80, buff);
-	sprintf(buff, "STACK: $%04X", cpu->stkp);
+	sprintf(buff, "STACK: $%04X", viewRegs.stkp);
 	drawString(x, y + 100, buff);
-	sprintf(buff, "OPCODE: %s", cpu_getOpcode(cpu));
+	sprintf(buff, "OPCODE: %s", cpu_getOpcodeName(viewRegs.opcode));
 	drawString(x, y + 120, buff);
 }
 
 void
 drawString (int x, int y, char* chars)
-{ string = TTF_RenderText_Solid(font, chars, fontColor);
-	stringTexture = SDL_CreateTextureFromSurface(renderer, string);
+{
+	SDL_Rect location;
+	unsigned char c;
 
-	int w, h;
-	SDL_QueryTexture(stringTexture, NULL, NULL, &w, &h);
-	SDL_Rect location = {x, y, w, h};
-	SDL_RenderCopy(renderer, stringTexture, NULL, &location);
+	for (; *chars != '\0'; chars++) {
+		c = *chars;
+		if (c >= GLYPHS) {
+			continue;
+		}
 
-	SDL_DestroyTexture(stringTexture);
-	SDL_FreeSurface(string);
+		if (glyph[c] != NULL) {
+			location.x = x;
+			location.y = y;
+			location.w = glyphW[c];
+			location.h = glyphH[c];
+			SDL_RenderCopy(renderer, glyph[c], NULL, &location);
+		}
+		x += glyphW[c];
+	}
 }
+/*
+ * Performance HUD: guest rate, host frame time percentiles and the
+ * share of wall time each subsystem took over the last interval.
+ */
+void
+drawPerf(PerfReport* report)
+{
+	static const char* names[PERF_SPANS] = { "CPU", "BUS", "APU", "DRAW", "PRESENT" };
+	char buff[64];
+	int x = 500;
+	int y = 180;
+
+	sprintf(buff, "%.2f MHz  %.2f MIPS", report->mhz, report->ips / 1e6);
+	drawString(x, y, buff);
+	sprintf(buff, "FRAME %.1f/%.1f/%.1f ms", report->p50, report->p95, report->p99);
+	drawString(x, y + 20, buff);
+
+	for (int i = 0; i < PERF_SPANS; i++) {
+		sprintf(buff, "%-8s%5.1f%%", names[i], report->share[i]);
+		drawString(x, y + 60 + i * 20, buff);
+	}
+}
+
+/*
+ * Frame budget HUD: guest cycles used by the last frame and the running
+ * histogram of how much of the frame budget each frame took.
+ */
+void
+drawBudget()
+{
+	BudgetReport report;
+	char buff[64];
+	int x = 500;
+	int y = 360;
+
+	budget_report(&budget, &report);
+
+	sprintf(buff, "BUSY %u  NMI %u", report.lastBusy, report.lastNmi);
+	drawString(x, y, buff);
+	for (int i = 0; i < BUDGET_BUCKETS; i++) {
+		budget_bar(&report, i, 12, buff, sizeof(buff));
+		drawString(x, y + 20 + i * 20, buff);
+	}
+	sprintf(buff, "WORST %u/%u/%u  LAG %lu", report.worstBusy, report.worstNmi, report.worstLatency, report.lags);
+	drawString(x, y + 40 + BUDGET_BUCKETS * 20, buff);
+}
+
 /*
  * Usage Function
  * Called when something isn't right with the command line parameters.
  */
  void
  usage (char* program) {
-	 printf("Usage: %s \n[--file filename] [--viewport1] [--viewport2] \n[--initA] [--initX] [--initY]\n", program);
+	 printf("Usage: %s \n[--file filename] [--save filename] [--script filename] [--shm name] [--perf] [--trace file.json] [--budget file.csv] [--viewport1] [--viewport2] \n[--initA] [--initX] [--initY]\n", program);
  }
 
 int
@@ -224,6 +495,16 @@ main(int argc, char* argv[])
 	/* Input File */
 	char file[FILENAME_MAX] = "default.txt";
 
+	/* Battery-backed save file for $6000-$7FFF */
+	char* save = NULL;
+	Uint32 lastFlush = 0;
+
+	/* Automation script */
+	char* scriptFile = NULL;
+
+	/* Shared memory segment for external viewers */
+	char* shmName = NULL;
+
 	/* Viewports */
 	viewport1 = "0x0000";
 	viewport2 = "0x0100";
@@ -240,6 +521,12 @@ main(int argc, char* argv[])
 	/* Defines the options and their long/short equivalents. */
 	struct option longopts[] = {
 		{ "file", required_argument, NULL, 'f'},
+		{ "save", required_argument, NULL, 's'},
+		{ "script", required_argument, NULL, 'S'},
+		{ "shm", required_argument, NULL, 'm'},
+		{ "perf", no_argument, NULL, 'p'},
+		{ "trace", required_argument, NULL, 'T'},
+		{ "budget", required_argument, NULL, 'B'},
 		{ "viewport-1", required_argument, NULL, '1' },
 		{ "viewport-2", required_argument, NULL, '2' },
 		{ "initA", required_argument, NULL, 'a'},
@@ -251,11 +538,30 @@ main(int argc, char* argv[])
 	/* loop flag */
 	int quit = 0;
 
+	/* Speed readout */
+	Uint32 speedAt = 0;
+	unsigned long frames, lastFrames = 0;
+	unsigned long dropped, lastSkipped = 0;
+	double speed;
+	char speedText[64] = "";
+
+	/* Performance HUD */
+	PerfReport report;
+	char perfText[200] = "";
+	unsigned long long start;
+
+	/* Chrome trace-event output */
+	char* traceFile = NULL;
+
+	/* Frame budget CSV, "-" for the HUD only */
+	char* budgetFile = NULL;
+	unsigned long long span;
+
 	/* Event handler */
 	SDL_Event e;
 
 	/* Processes the command-line parameters */
-	while ((ch = getopt_long(argc, argv, "f:1:2:a:x:y:h", longopts, &option_index)) != -1) {
+	while ((ch = getopt_long(argc, argv, "f:s:S:m:pT:B:1:2:a:x:y:h", longopts, &option_index)) != -1) {
 		switch (ch) {
 
 			case '1':
@@ -270,6 +576,32 @@ main(int argc, char* argv[])
 				strcpy(file, optarg);
 				break;
 
+			case 's':
+				save = optarg;
+				break;
+
+			case 'S':
+				scriptFile = optarg;
+				break;
+
+			case 'm':
+				shmName = optarg;
+				break;
+
+			case 'p':
+				measure = 1;
+				showPerf = 1;
+				break;
+
+			case 'T':
+				traceFile = optarg;
+				break;
+
+			case 'B':
+				budgetFile = optarg;
+				monitor = 1;
+				break;
+
 			case 'a':
 				initA = optarg;
 				break;
@@ -283,7 +615,8 @@ main(int argc, char* argv[])
 				break;
 
 			case 'h':
-				printf("Enter a filename with -f. Change viewport areas with -1 and -2. \nEnter initial register values with -a, -x, and -y.\n\n");
+				printf("Keys: space steps, r runs/stops, hold tab to fast forward, t toggles turbo, p toggles the --perf HUD.\n");
+				printf("Enter a filename with -f. Persist save RAM to a file with -s. \nRun an automation script with -S. Publish live state to shared memory with -m. \nMeasure host timing with -p, or record a Chrome trace with -T file.json. \nShow the frame budget HUD and log it per frame with -B file.csv (- for no file). \nChange viewport areas with -1 and -2. \nEnter initial register values with -a, -x, and -y.\n\n");
       			usage(argv[0]);
       			return 0;
 
@@ -306,6 +639,48 @@ main(int argc, char* argv[])
 
 	startEmu();
 
+	if (traceFile != NULL) {
+		trace_start();
+		trace_thread("ui");
+	}
+
+	/* device threads read the bus perf pointer, so set it before they start */
+	memset(&report, 0, sizeof(report));
+	if (measure) {
+		perf_init(&perf);
+		nes.perf = &perf;
+	}
+
+	startAudio();
+
+	if (save != NULL && !bus_mapSram(&nes, save)) {
+		fprintf(stderr, "Save RAM could not be mapped, continuing without it.\n");
+	}
+
+	/* the snapshot doubles as the shared memory export when --shm is given */
+	if (!export_open(&shared, shmName, cpu)) {
+		fprintf(stderr, "State snapshot could not be created.\n");
+		closeSDL();
+		return 1;
+	}
+
+	if (scriptFile != NULL && !script_load(&script, scriptFile, cpu)) {
+		closeSDL();
+		return 1;
+	}
+
+	if (monitor && !budget_attach(&budget, cpu, strcmp(budgetFile, "-") != 0 ? budgetFile : NULL)) {
+		closeSDL();
+		return 1;
+	}
+
+	emuThread = SDL_CreateThread(emulate, "emulate", NULL);
+	if (emuThread == NULL) {
+		fprintf(stderr, "Emulation thread could not be created! SDL_Error: %s\n", SDL_GetError());
+		closeSDL();
+		return 1;
+	}
+
 	while(0){
 	
 		for(int i = 0; i < 16*16; i++) {
@@ -326,10 +701,7 @@ main(int argc, char* argv[])
 
 		}
 
-		do
-		{
-			cpu_clock(cpu);
-		} while (cpu->cycles != 0);
+		core_step(cpu);
 
 		getchar();
 	}
@@ -344,14 +716,58 @@ main(int argc, char* argv[])
 			if (e.type == SDL_KEYDOWN) {
 				switch (e.key.keysym.sym) {
 					case SDLK_SPACE:
-						do {
-							cpu_clock(cpu);
-						} while (cpu->cycles != 0);
+						atomic_store(&running, 0);
+						atomic_fetch_add(&steps, 1);
+					break;
+
+					case SDLK_r:
+						atomic_store(&running, !atomic_load(&running));
+					break;
+
+					case SDLK_p:
+						showPerf = measure && !showPerf;
+					break;
+
+					case SDLK_TAB:
+						atomic_store(&fastForward, 1);
+					break;
+
+					case SDLK_t:
+						if (!e.key.repeat) {
+							atomic_store(&turbo, !atomic_load(&turbo));
+						}
 					break;
 				}
 			}
+
+			if (e.type == SDL_KEYUP && e.key.keysym.sym == SDLK_TAB) {
+				atomic_store(&fastForward, 0);
+			}
 		}
 
+		/* speed readout */
+		if (SDL_GetTicks() - speedAt >= SPEED_MS) {
+			frames = atomic_load(&emulated);
+			dropped = atomic_load(&skipped);
+			speed = (frames - lastFrames) * 1000.0 / ((double)(SDL_GetTicks() - speedAt) * FRAME_RATE);
+			sprintf(speedText, "%s%.1fx  skipped %lu",
+				(atomic_load(&turbo) ? "TURBO " : (atomic_load(&fastForward) ? ">> " : "")), speed, dropped - lastSkipped);
+			lastFrames = frames;
+			lastSkipped = dropped;
+			speedAt = SDL_GetTicks();
+
+			if (measure) {
+				perf_report(&perf, &report);
+				perf_format(&report, perfText, sizeof(perfText));
+				fprintf(stderr, "perf: %s\n", perfText);
+			}
+		}
+
+		start = measure ? perf_now() : 0;
+		span = trace_begin();
+
+		/* take the newest frame the emulation thread published */
+		export_read(shared.state, &viewRegs, viewRam);
 
 		/* drawing */
 		SDL_SetRenderDrawColor(renderer, 0xFF, 0xFF, 0xFF, 0xFF);
@@ -363,11 +779,67 @@ main(int argc, char* argv[])
 		/* draw cpu */
 		drawCPU();
 
+		drawString(500, 680, speedText);
+
+		if (showPerf) {
+			drawPerf(&report);
+		}
+
+		if (monitor) {
+			drawBudget();
+		}
+
+		if (measure) {
+			perf_add(&perf, PERF_DRAW, start);
+			start = perf_now();
+		}
+		trace_end("draw", span);
+		span = trace_begin();
+
 		/* update screen */
 		SDL_RenderPresent(renderer);
+
+		if (measure) {
+			perf_add(&perf, PERF_PRESENT, start);
+		}
+		trace_end("present", span);
+
+		if (script.quit) {
+			quit = 1;
+		}
+
+		/* schedule save RAM writeback, never on the guest's write path */
+		if (SDL_GetTicks() - lastFlush >= SRAM_FLUSH_MS) {
+			bus_flushSram(&nes);
+			lastFlush = SDL_GetTicks();
+		}
+	}
+
+	atomic_store(&quitting, 1);
+	SDL_WaitThread(emuThread, NULL);
+
+	if (audioDev != 0) {
+		SDL_CloseAudioDevice(audioDev);
+	}
+	apu_close(&apu);
+
+	if (traceFile != NULL && trace_write(traceFile)) {
+		printf("Trace written to %s\n", traceFile);
 	}
 
+	budget_detach(&budget);
+	bus_unmapSram(&nes);
+	export_close(&shared);
+
 	closeSDL();
 
+	if (scriptFile != NULL) {
+		script_unload(&script);
+		if (script.failures > 0) {
+			fprintf(stderr, "%d assertion(s) failed\n", script.failures);
+			return 1;
+		}
+	}
+
 	return 0;
 }
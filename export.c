@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "export.h"
+#include "trace.h"
+
+# define UNUSED(x) (void)(x)
+
+/* Frame hook: publishes once per frame so the emulator never waits on readers. */
+static void
+export_frame(void* user, HOOK_EVENT ev, unsigned short addr, unsigned char data)
+{
+	UNUSED(ev);
+	UNUSED(addr);
+	UNUSED(data);
+
+	if (!((Export*)user)->hold) {
+		export_publish(user);
+	}
+}
+
+/* 
+ * Creates (or reuses) the named shared memory segment and
+ * publishes into it at every frame end. A NULL name gives a private
+ * anonymous segment for readers inside this process (the UI thread).
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+export_open(Export* ex, const char* name, CPU* cpu)
+{
+	int fd;
+	ExportState* state;
+
+	ex->state = NULL;
+	ex->cpu = cpu;
+	ex->hold = 0;
+	ex->name[0] = '\0';
+
+	if (name == NULL) {
+		state = mmap(NULL, sizeof(ExportState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (state == MAP_FAILED) {
+			perror("export");
+			return 0;
+		}
+	} else {
+		snprintf(ex->name, sizeof(ex->name), "%s", name);
+
+		fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+		if (fd < 0) {
+			perror(name);
+			return 0;
+		}
+
+		if (ftruncate(fd, sizeof(ExportState)) < 0) {
+			perror(name);
+			close(fd);
+			shm_unlink(name);
+			return 0;
+		}
+
+		state = mmap(NULL, sizeof(ExportState), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (state == MAP_FAILED) {
+			perror(name);
+			shm_unlink(name);
+			return 0;
+		}
+	}
+
+	memset(state, 0, sizeof(ExportState));
+	state->header.magic = EXPORT_MAGIC;
+	state->header.version = EXPORT_VERSION;
+	state->header.size = sizeof(ExportState);
+	state->header.regsOffset = offsetof(ExportState, regs);
+	state->header.ramOffset = offsetof(ExportState, ram);
+	state->header.ramSize = MEM_SIZE;
+
+	if (!bus_hook(cpu->bus, HOOK_FRAME, export_frame, ex, 0x0000, 0xFFFF)) {
+		munmap(state, sizeof(ExportState));
+		if (name != NULL) {
+			shm_unlink(name);
+		}
+		return 0;
+	}
+
+	ex->state = state;
+	export_publish(ex);
+	return 1;
+}
+
+/* Copies the current registers and RAM into the segment under the seqlock. */
+void
+export_publish(Export* ex)
+{
+	ExportState* state = ex->state;
+	CPU* cpu = ex->cpu;
+	unsigned long long span = trace_begin();
+	uint32_t seq;
+	int i;
+
+	if (state == NULL) {
+		return;
+	}
+
+	seq = atomic_load_explicit(&state->header.seq, memory_order_relaxed);
+	atomic_store_explicit(&state->header.seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	state->regs.pc = cpu->pc;
+	state->regs.a = cpu->a;
+	state->regs.x = cpu->x;
+	state->regs.y = cpu->y;
+	state->regs.stkp = cpu->stkp;
+	state->regs.status = cpu->status;
+	state->regs.opcode = cpu->opcode;
+
+	/* copy through the page table so remapped regions (save RAM) are current */
+	for (i = 0; i < PAGE_COUNT; i++) {
+		memcpy(&state->ram[i << PAGE_BITS], cpu->bus->page[i], PAGE_BYTES);
+	}
+
+	state->header.frame++;
+
+	atomic_store_explicit(&state->header.seq, seq + 2, memory_order_release);
+
+	trace_end("publish", span);
+}
+
+/* Stops publishing and removes the segment if it was named. */
+void
+export_close(Export* ex)
+{
+	if (ex->state == NULL) {
+		return;
+	}
+
+	bus_unhook(ex->cpu->bus, HOOK_FRAME, export_frame, ex);
+	munmap(ex->state, sizeof(ExportState));
+	if (ex->name[0] != '\0') {
+		shm_unlink(ex->name);
+	}
+	ex->state = NULL;
+}
+
+/* 
+ * Reader side: takes a consistent copy of the registers and RAM.
+ * Either output may be NULL.
+ * returns 1 on success
+ * returns 0 if the writer kept updating and no consistent copy was taken
+ */
+int
+export_read(ExportState* state, ExportRegs* regs, unsigned char* ram)
+{
+	uint32_t before, after;
+	int tries;
+
+	for (tries = 0; tries < 100; tries++) {
+		before = atomic_load_explicit(&state->header.seq, memory_order_acquire);
+		if (before & 1) {
+			continue;
+		}
+
+		if (regs != NULL) {
+			memcpy(regs, &state->regs, sizeof(ExportRegs));
+		}
+		if (ram != NULL) {
+			memcpy(ram, state->ram, MEM_SIZE);
+		}
+
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&state->header.seq, memory_order_relaxed);
+		if (before == after) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
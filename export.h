@@ -0,0 +1,74 @@
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "cpu.h"
+
+/*
+ * Live state export.
+ * The emulator publishes its state into a POSIX shared memory segment once
+ * per frame so external tools can map it and read without syscalls.
+ * Consistency is kept with a seqlock: the writer makes seq odd while it
+ * copies and even when done; readers retry if seq was odd or changed.
+ *
+ * The layout uses fixed width types since it is read by other processes.
+ * Sections are located by offset so later sections (framebuffer, OAM)
+ * can be added without breaking readers; an offset of 0 means absent.
+ */
+#define EXPORT_MAGIC 0x3153454E /* "NES1" */
+#define EXPORT_VERSION 1
+
+typedef struct exportRegs ExportRegs;
+typedef struct exportHeader ExportHeader;
+typedef struct exportState ExportState;
+typedef struct export Export;
+
+struct exportRegs {
+	uint16_t pc;
+	uint8_t a;
+	uint8_t x;
+	uint8_t y;
+	uint8_t stkp;
+	uint8_t status;
+	uint8_t opcode;
+};
+
+struct exportHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;          /* size of the whole segment */
+	_Atomic uint32_t seq;   /* seqlock sequence */
+	uint64_t frame;         /* frames published so far */
+
+	uint32_t regsOffset;
+	uint32_t ramOffset;
+	uint32_t ramSize;
+	uint32_t fbOffset;      /* reserved for the framebuffer */
+	uint32_t fbSize;
+	uint32_t oamOffset;     /* reserved for OAM */
+	uint32_t oamSize;
+};
+
+/* Segment layout */
+struct exportState {
+	ExportHeader header;
+	ExportRegs regs;
+	unsigned char ram[MEM_SIZE];
+};
+
+struct export {
+	char name[64];
+	ExportState* state;   /* NULL when not open */
+	CPU* cpu;
+	int hold;             /* frame ends do not publish while set */
+};
+
+int export_open(Export* ex, const char* name, CPU* cpu);
+void export_publish(Export* ex);
+void export_close(Export* ex);
+
+int export_read(ExportState* state, ExportRegs* regs, unsigned char* ram);
+
+#endif
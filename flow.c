@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "flow.h"
+
+/* Operations whose indexed reads take a cycle more across a page (operate returns 1) */
+#define PAGE_PENALTY(op) ((op) == ADC || (op) == AND || (op) == CMP || (op) == EOR || (op) == LDA \
+	|| (op) == LDX || (op) == LDY || (op) == ORA || (op) == SBC)
+
+#define IS_BRANCH(opcode) ((opcode & 0x1F) == 0x10)
+#define OP_BRK 0x00
+#define OP_JSR 0x20
+#define OP_RTI 0x40
+#define OP_JMP 0x4C
+#define OP_RTS 0x60
+#define OP_JMP_IND 0x6C
+
+static const char* exitNames[] = { "fall", "branch", "jump", "indirect", "call", "return", "break", "stop" };
+
+/* Starts with an empty image. */
+void
+flow_init(Flow* flow)
+{
+	memset(flow, 0, sizeof(Flow));
+}
+
+/* Copies image bytes to addr; bytes past $FFFF are dropped. */
+void
+flow_load(Flow* flow, unsigned short addr, const unsigned char* data, long size)
+{
+	long i;
+
+	for (i = 0; i < size && addr + i < MEM_SIZE; i++) {
+		flow->mem[addr + i] = data[i];
+		flow->loaded[addr + i] = 1;
+	}
+}
+
+static unsigned short
+flow_word(Flow* flow, unsigned short addr)
+{
+	return flow->mem[addr] | (flow->mem[(unsigned short)(addr + 1)] << 8);
+}
+
+/* Marks an address code execution starts at. */
+void
+flow_entry(Flow* flow, unsigned short addr, int kind)
+{
+	flow->entry[addr] |= kind;
+}
+
+/* Adds the NMI, reset and IRQ vectors that point into the image. */
+void
+flow_vectors(Flow* flow)
+{
+	static const int kinds[3] = { FLOW_NMI, FLOW_RESET, FLOW_IRQ };
+	unsigned short vector, target;
+	int i;
+
+	for (i = 0, vector = 0xFFFA; i < 3; i++, vector += 2) {
+		target = flow_word(flow, vector);
+		if (flow->loaded[vector] && flow->loaded[vector + 1] && flow->loaded[target]) {
+			flow_entry(flow, target, kinds[i]);
+		}
+	}
+}
+
+/* returns the length in bytes of the instruction with the input opcode */
+int
+flow_length(unsigned char opcode)
+{
+	unsigned char (*mode)(CPU*) = lookup[opcode].addr_mode;
+
+	if (mode == IMP) {
+		return 1;
+	}
+	if (mode == ABS || mode == ABX || mode == ABY || mode == IND) {
+		return 3;
+	}
+	return 2;
+}
+
+/* Gives the flags an opcode reads (use) and sets (def), within FLOW_FLAGS. */
+void
+flow_flags(unsigned char opcode, unsigned char* use, unsigned char* def)
+{
+	unsigned char (*op)(CPU*) = lookup[opcode].operate;
+
+	*use = 0;
+	*def = 0;
+
+	if (op == ADC || op == SBC) {
+		*use = C;
+		*def = C | Z | V | N;
+	} else if (op == ROL || op == ROR) {
+		*use = C;
+		*def = C | Z | N;
+	} else if (op == ASL || op == LSR || op == CMP || op == CPX || op == CPY) {
+		*def = C | Z | N;
+	} else if (op == BIT) {
+		*def = Z | V | N;
+	} else if (op == AND || op == ORA || op == EOR || op == LDA || op == LDX || op == LDY
+		|| op == INC || op == INX || op == INY || op == DEC || op == DEX || op == DEY
+		|| op == TAX || op == TAY || op == TSX || op == TXA || op == TYA || op == PLA) {
+		*def = Z | N;
+	} else if (op == BCC || op == BCS) {
+		*use = C;
+	} else if (op == BEQ || op == BNE) {
+		*use = Z;
+	} else if (op == BMI || op == BPL) {
+		*use = N;
+	} else if (op == BVC || op == BVS) {
+		*use = V;
+	} else if (op == CLC || op == SEC) {
+		*def = C;
+	} else if (op == CLV) {
+		*def = V;
+	} else if (op == PHP || op == BRK) {
+		*use = FLOW_FLAGS;
+	} else if (op == PLP || op == RTI) {
+		*def = FLOW_FLAGS;
+	}
+}
+
+/*
+ * Finds the target of a JMP () whose pointer lies in the image's ROM,
+ * with the 6502 page wrap of the pointer's high byte.
+ * returns 1 if the target is known
+ */
+static int
+flow_indirect(Flow* flow, unsigned short at, unsigned short* target)
+{
+	unsigned short p = flow_word(flow, at + 1);
+	unsigned short hi = (p & 0xFF) == 0xFF ? (p & 0xFF00) : (unsigned short)(p + 1);
+
+	if (p < 0x8000 || !flow->loaded[p] || !flow->loaded[hi]) {
+		return 0;
+	}
+
+	*target = flow->mem[p] | (flow->mem[hi] << 8);
+	return 1;
+}
+
+/*
+ * Decodes straight-line code from start until it ends in a jump or
+ * return or meets code decoded before. Targets go on the work list.
+ */
+static void
+flow_trace(Flow* flow, unsigned short start, unsigned short* work, int* nwork)
+{
+	unsigned short addr = start;
+	unsigned short next, target;
+	unsigned char opcode;
+	int length, i;
+
+	for (;;) {
+		if (flow->kind[addr] == FLOW_OPCODE) {
+			return;
+		}
+		if (flow->kind[addr] == FLOW_OPERAND) {
+			flow->conflicts++;
+			return;
+		}
+
+		opcode = flow->mem[addr];
+		length = flow_length(opcode);
+
+		if (!flow->loaded[addr] || strcmp(lookup[opcode].name, "XXX") == 0) {
+			flow->stops++;
+			return;
+		}
+		for (i = 1; i < length; i++) {
+			if (!flow->loaded[(unsigned short)(addr + i)] || flow->kind[(unsigned short)(addr + i)] != FLOW_DATA) {
+				flow->conflicts++;
+				return;
+			}
+		}
+
+		flow->kind[addr] = FLOW_OPCODE;
+		for (i = 1; i < length; i++) {
+			flow->kind[(unsigned short)(addr + i)] = FLOW_OPERAND;
+		}
+		next = addr + length;
+
+		if (IS_BRANCH(opcode)) {
+			target = next + (signed char)flow->mem[(unsigned short)(addr + 1)];
+			flow->leader[target] = 1;
+			flow->leader[next] = 1;
+			work[(*nwork)++] = target;
+		} else if (opcode == OP_JSR) {
+			target = flow_word(flow, addr + 1);
+			flow->entry[target] |= FLOW_CALL;
+			flow->leader[target] = 1;
+			flow->leader[next] = 1;
+			work[(*nwork)++] = target;
+		} else if (opcode == OP_JMP || (opcode == OP_JMP_IND && flow_indirect(flow, addr, &target))) {
+			if (opcode == OP_JMP) {
+				target = flow_word(flow, addr + 1);
+			}
+			flow->leader[target] = 1;
+			work[(*nwork)++] = target;
+			return;
+		} else if (opcode == OP_JMP_IND || opcode == OP_RTS || opcode == OP_RTI || opcode == OP_BRK) {
+			return;
+		}
+
+		addr = next;
+	}
+}
+
+/* Ends the block at the instruction at addr and works out how it exits. */
+static void
+flow_close(Flow* flow, FLOW_BLOCK* block, unsigned short addr)
+{
+	unsigned char opcode = flow->mem[addr];
+	unsigned short next = addr + flow_length(opcode);
+
+	block->last = addr;
+	block->next = next;
+
+	if (IS_BRANCH(opcode)) {
+		block->exit = EXIT_BRANCH;
+		block->target = next + (signed char)flow->mem[(unsigned short)(addr + 1)];
+		block->taken = 1 + ((block->target & 0xFF00) != (next & 0xFF00));
+	} else if (opcode == OP_JSR) {
+		block->exit = EXIT_CALL;
+		block->target = flow_word(flow, addr + 1);
+	} else if (opcode == OP_JMP) {
+		block->exit = EXIT_JUMP;
+		block->target = flow_word(flow, addr + 1);
+	} else if (opcode == OP_JMP_IND) {
+		block->exit = flow_indirect(flow, addr, &block->target) ? EXIT_JUMP : EXIT_INDIRECT;
+	} else if (opcode == OP_RTS || opcode == OP_RTI) {
+		block->exit = EXIT_RETURN;
+	} else if (opcode == OP_BRK) {
+		block->exit = EXIT_BREAK;
+	} else if (flow->kind[next] == FLOW_OPCODE) {
+		block->exit = EXIT_FALL;
+		block->target = next;
+	} else {
+		block->exit = EXIT_STOP;
+	}
+}
+
+/* Splits the decoded code into basic blocks. */
+static void
+flow_blocks(Flow* flow)
+{
+	FLOW_BLOCK* block = NULL;
+	const INSTRUCTION* ins;
+	unsigned short next;
+	long addr;
+
+	for (addr = 0; addr < MEM_SIZE; addr++) {
+		flow->block[addr] = -1;
+	}
+
+	for (addr = 0; addr < MEM_SIZE; addr++) {
+		if (flow->kind[addr] != FLOW_OPCODE) {
+			continue;
+		}
+
+		if (block == NULL || flow->leader[addr] || flow->entry[addr]) {
+			if (flow->nblocks >= FLOW_BLOCKS) {
+				fprintf(stderr, "more than %d blocks, the rest are left out\n", FLOW_BLOCKS);
+				return;
+			}
+			block = &flow->blocks[flow->nblocks++];
+			memset(block, 0, sizeof(FLOW_BLOCK));
+			block->start = addr;
+			block->routine = -1;
+		}
+
+		ins = &lookup[flow->mem[addr]];
+		flow->block[addr] = flow->nblocks - 1;
+		block->count++;
+		block->cycles += ins->cycles;
+
+		/* an indexed base at the start of a page can not cross it */
+		if (PAGE_PENALTY(ins->operate) && (ins->addr_mode == IZY
+			|| ((ins->addr_mode == ABX || ins->addr_mode == ABY) && flow->mem[(unsigned short)(addr + 1)] != 0))) {
+			block->crossings++;
+		}
+
+		next = addr + flow_length(flow->mem[addr]);
+		if (IS_BRANCH(flow->mem[addr]) || ins->operate == JSR || ins->operate == JMP || ins->operate == RTS
+			|| ins->operate == RTI || ins->operate == BRK
+			|| flow->kind[next] != FLOW_OPCODE || flow->leader[next] || flow->entry[next]) {
+			flow_close(flow, block, addr);
+			block = NULL;
+		}
+	}
+}
+
+/* Finds the flag updates in each block that are overwritten before being read. */
+static void
+flow_liveness(Flow* flow)
+{
+	FLOW_BLOCK* block;
+	unsigned char live, use, def, dead;
+	unsigned short addr;
+	int b;
+
+	for (b = 0; b < flow->nblocks; b++) {
+		block = &flow->blocks[b];
+		live = FLOW_FLAGS;
+
+		for (addr = block->last;; addr--) {
+			while (flow->kind[addr] != FLOW_OPCODE) {
+				addr--;
+			}
+
+			flow_flags(flow->mem[addr], &use, &def);
+			dead = def & ~live;
+			flow->dead[addr] = dead;
+			for (; dead; dead &= dead - 1) {
+				block->dead++;
+			}
+			live = (live & ~def) | use;
+
+			if (addr == block->start) {
+				break;
+			}
+		}
+	}
+}
+
+/* Collects the blocks and callees of each routine. */
+static void
+flow_routines(Flow* flow)
+{
+	int* seen = calloc(flow->nblocks, sizeof(int));
+	int* stack = malloc(flow->nblocks * 2 * sizeof(int) + sizeof(int));
+	FLOW_ROUTINE* routine;
+	FLOW_BLOCK* block;
+	long addr;
+	int depth, b, i;
+
+	if (seen == NULL || stack == NULL) {
+		free(seen);
+		free(stack);
+		return;
+	}
+
+	for (addr = 0; addr < MEM_SIZE; addr++) {
+		if (!(flow->entry[addr] & ~FLOW_COVERED) || flow->block[addr] < 0) {
+			continue;
+		}
+		if (flow->nroutines >= FLOW_ROUTINES) {
+			fprintf(stderr, "more than %d routines, the rest are left out\n", FLOW_ROUTINES);
+			break;
+		}
+
+		routine = &flow->routines[flow->nroutines++];
+		memset(routine, 0, sizeof(FLOW_ROUTINE));
+		routine->entry = addr;
+		routine->kinds = flow->entry[addr];
+
+		/* depth-first over the blocks, not into callees */
+		depth = 0;
+		stack[depth++] = flow->block[addr];
+		while (depth > 0) {
+			b = stack[--depth];
+			if (b < 0 || seen[b] == flow->nroutines) {
+				continue;
+			}
+			seen[b] = flow->nroutines;
+
+			block = &flow->blocks[b];
+			if (block->routine < 0) {
+				block->routine = flow->nroutines - 1;
+			}
+			routine->blocks++;
+			routine->instructions += block->count;
+
+			switch (block->exit) {
+				case EXIT_CALL:
+					for (i = 0; i < routine->ncalls && routine->calls[i] != block->target; i++);
+					if (i == routine->ncalls && i < FLOW_CALLS) {
+						routine->calls[routine->ncalls++] = block->target;
+					}
+					stack[depth++] = flow->block[block->next];
+					break;
+
+				case EXIT_BRANCH:
+					stack[depth++] = flow->block[block->next];
+					stack[depth++] = flow->block[block->target];
+					break;
+
+				case EXIT_FALL:
+				case EXIT_JUMP:
+					stack[depth++] = flow->block[block->target];
+					break;
+
+				case EXIT_INDIRECT:
+					routine->indirect = 1;
+					break;
+
+				default:
+					break;
+			}
+		}
+	}
+
+	free(seen);
+	free(stack);
+}
+
+/* Recovers code, blocks and routines from the entry points. */
+void
+flow_analyze(Flow* flow)
+{
+	unsigned short* work = malloc(2 * (MEM_SIZE) * sizeof(unsigned short));
+	int nwork = 0;
+	long addr;
+
+	if (work == NULL) {
+		perror("flow");
+		return;
+	}
+
+	for (addr = 0; addr < MEM_SIZE; addr++) {
+		if (flow->entry[addr]) {
+			flow->leader[addr] = 1;
+			work[nwork++] = addr;
+		}
+	}
+
+	while (nwork > 0) {
+		flow_trace(flow, work[--nwork], work, &nwork);
+	}
+	free(work);
+
+	flow_blocks(flow);
+	flow_liveness(flow);
+	flow_routines(flow);
+}
+
+/*
+ * Disassembles the instruction at addr, e.g. "LDA $0200,X".
+ * returns the length written
+ */
+int
+flow_format(Flow* flow, unsigned short addr, char* out, int size)
+{
+	const INSTRUCTION* ins = &lookup[flow->mem[addr]];
+	unsigned char (*mode)(CPU*) = ins->addr_mode;
+	unsigned char lo = flow->mem[(unsigned short)(addr + 1)];
+	unsigned short word = flow_word(flow, addr + 1);
+
+	if (mode == IMP) {
+		if (ins->operate == ASL || ins->operate == LSR || ins->operate == ROL || ins->operate == ROR) {
+			return snprintf(out, size, "%s A", ins->name);
+		}
+		return snprintf(out, size, "%s", ins->name);
+	}
+	if (ins->operate == BRK) {
+		return snprintf(out, size, "%s", ins->name);
+	}
+	if (mode == IMM) {
+		return snprintf(out, size, "%s #$%02X", ins->name, lo);
+	}
+	if (mode == ZP0) {
+		return snprintf(out, size, "%s $%02X", ins->name, lo);
+	}
+	if (mode == ZPX) {
+		return snprintf(out, size, "%s $%02X,X", ins->name, lo);
+	}
+	if (mode == ZPY) {
+		return snprintf(out, size, "%s $%02X,Y", ins->name, lo);
+	}
+	if (mode == REL) {
+		return snprintf(out, size, "%s $%04X", ins->name, (unsigned short)(addr + 2 + (signed char)lo));
+	}
+	if (mode == ABX) {
+		return snprintf(out, size, "%s $%04X,X", ins->name, word);
+	}
+	if (mode == ABY) {
+		return snprintf(out, size, "%s $%04X,Y", ins->name, word);
+	}
+	if (mode == IND) {
+		return snprintf(out, size, "%s ($%04X)", ins->name, word);
+	}
+	if (mode == IZX) {
+		return snprintf(out, size, "%s ($%02X,X)", ins->name, lo);
+	}
+	if (mode == IZY) {
+		return snprintf(out, size, "%s ($%02X),Y", ins->name, lo);
+	}
+	return snprintf(out, size, "%s $%04X", ins->name, word);
+}
+
+/* returns the block map name of an exit kind */
+const char*
+flow_exitName(FLOW_EXIT exit)
+{
+	return exitNames[exit];
+}
@@ -0,0 +1,117 @@
+#ifndef FLOW_H
+#define FLOW_H
+
+#include "cpu.h"
+
+/*
+ * Static control-flow recovery for 6502 program images.
+ * Code is found by recursive descent from entry points (vectors, known
+ * routine addresses, executed addresses from coverage), following
+ * branches, jumps and calls; loaded bytes never reached stay data.
+ * Reached code is split into basic blocks, each annotated with its cycle
+ * cost, and blocks are grouped into routines for the call graph.
+ *
+ * A block ends at a branch, jump, call, return, or where another block
+ * starts, so every block is entered only at its first instruction.
+ * Block cycles count the not-taken path; taken branches and indexed
+ * reads that may cross a page are listed separately, and are folded in
+ * wherever the address is known statically.
+ *
+ * Flag liveness is worked out backward through each block: an update of
+ * C, Z, V or N is dead when a later instruction of the same block sets the
+ * flag again before a branch, PHP, BRK or the block exit can read it.
+ * Every flag counts as live at the exit. The result is informational:
+ * the interpreter always computes every flag, and only cfg reports dead
+ * updates. A future block translator may skip them, but only if it takes
+ * interrupts between blocks and never inside one; the status is exact
+ * at every block exit, not at every instruction.
+ */
+#define FLOW_BLOCKS 8192
+#define FLOW_ROUTINES 1024
+#define FLOW_CALLS 16       /* distinct callees kept per routine */
+
+/* byte kinds */
+#define FLOW_DATA 0
+#define FLOW_OPCODE 1
+#define FLOW_OPERAND 2
+
+/* entry kinds, a bit each */
+#define FLOW_RESET (1 << 0)
+#define FLOW_NMI (1 << 1)
+#define FLOW_IRQ (1 << 2)
+#define FLOW_CALL (1 << 3)      /* JSR target */
+#define FLOW_GIVEN (1 << 4)     /* named on the command line or by the image */
+#define FLOW_COVERED (1 << 5)   /* executed, from coverage */
+
+/* flags liveness is tracked for; I, D, B and U are always kept */
+#define FLOW_FLAGS (C | Z | V | N)
+
+typedef enum flowExit FLOW_EXIT;
+typedef struct flowBlock FLOW_BLOCK;
+typedef struct flowRoutine FLOW_ROUTINE;
+typedef struct flow Flow;
+
+enum flowExit {
+	EXIT_FALL,       /* runs into the next block */
+	EXIT_BRANCH,     /* conditional: target or fall through */
+	EXIT_JUMP,       /* JMP to a known target */
+	EXIT_INDIRECT,   /* JMP () through a RAM pointer */
+	EXIT_CALL,       /* JSR: target, then the next block on return */
+	EXIT_RETURN,     /* RTS / RTI */
+	EXIT_BREAK,      /* BRK */
+	EXIT_STOP,       /* runs into an undefined opcode, data or the image end */
+};
+
+struct flowBlock {
+	unsigned short start;
+	unsigned short last;        /* address of the last instruction */
+	unsigned short next;        /* address after the block */
+	unsigned short target;      /* branch, jump or call target */
+	int count;                  /* instructions */
+	int cycles;                 /* not taken, no page crossings */
+	int taken;                  /* extra cycles when the branch is taken */
+	int crossings;              /* reads that may add a page crossing cycle */
+	int dead;                   /* flag updates nothing reads */
+	FLOW_EXIT exit;
+	int routine;                /* first routine reaching the block */
+};
+
+struct flowRoutine {
+	unsigned short entry;
+	int kinds;                  /* FLOW_RESET ... */
+	int blocks;
+	int instructions;
+	int ncalls;
+	unsigned short calls[FLOW_CALLS];
+	int indirect;               /* has a JMP () it could not follow */
+};
+
+struct flow {
+	unsigned char mem[MEM_SIZE];
+	unsigned char loaded[MEM_SIZE];   /* 1 where the image has a byte */
+	unsigned char kind[MEM_SIZE];     /* FLOW_DATA, FLOW_OPCODE, FLOW_OPERAND */
+	unsigned char leader[MEM_SIZE];   /* a block starts here */
+	unsigned char entry[MEM_SIZE];    /* entry kind bits */
+	int block[MEM_SIZE];              /* block of each opcode byte, -1 elsewhere */
+	unsigned char dead[MEM_SIZE];     /* flags an opcode sets that are overwritten unread */
+
+	FLOW_BLOCK blocks[FLOW_BLOCKS];
+	int nblocks;
+	FLOW_ROUTINE routines[FLOW_ROUTINES];
+	int nroutines;
+
+	int conflicts;                    /* jumps into the middle of an instruction */
+	int stops;                        /* paths that ran into non-code */
+};
+
+void flow_init(Flow* flow);
+void flow_load(Flow* flow, unsigned short addr, const unsigned char* data, long size);
+void flow_vectors(Flow* flow);
+void flow_entry(Flow* flow, unsigned short addr, int kind);
+void flow_analyze(Flow* flow);
+int flow_length(unsigned char opcode);
+void flow_flags(unsigned char opcode, unsigned char* use, unsigned char* def);
+int flow_format(Flow* flow, unsigned short addr, char* out, int size);
+const char* flow_exitName(FLOW_EXIT exit);
+
+#endif
@@ -0,0 +1,86 @@
+#include "hook.h"
+
+/* Removes every registered hook. */
+void
+hook_clear(Hooks* hooks)
+{
+	int i;
+
+	hooks->mask = 0;
+	for (i = 0; i < HOOK_EVENTS; i++) {
+		hooks->count[i] = 0;
+	}
+}
+
+/* 
+ * Registers a callback for an event. The callback only fires for addresses
+ * within lo-hi; pass 0x0000-0xFFFF to receive every event.
+ * returns 1 on success
+ * returns 0 if the event has no free slots
+ */
+int
+hook_add(Hooks* hooks, HOOK_EVENT ev, hookFunc func, void* user, unsigned short lo, unsigned short hi)
+{
+	HOOK* h;
+
+	if (hooks->count[ev] >= HOOK_MAX) {
+		return 0;
+	}
+
+	h = &hooks->list[ev][hooks->count[ev]++];
+	h->func = func;
+	h->user = user;
+	h->lo = lo;
+	h->hi = hi;
+
+	hooks->mask |= (1 << ev);
+	return 1;
+}
+
+/* Unregisters every hook on the event matching the callback and user pointer. */
+void
+hook_remove(Hooks* hooks, HOOK_EVENT ev, hookFunc func, void* user)
+{
+	int i = 0;
+
+	while (i < hooks->count[ev]) {
+		if (hooks->list[ev][i].func == func && hooks->list[ev][i].user == user) {
+			hooks->list[ev][i] = hooks->list[ev][--hooks->count[ev]];
+		} else {
+			i++;
+		}
+	}
+
+	if (hooks->count[ev] == 0) {
+		hooks->mask &= ~(1 << ev);
+	}
+}
+
+/* Returns 1 if any hook on the event overlaps the lo-hi address range. */
+int
+hook_covers(Hooks* hooks, HOOK_EVENT ev, unsigned short lo, unsigned short hi)
+{
+	int i;
+
+	for (i = 0; i < hooks->count[ev]; i++) {
+		if (hooks->list[ev][i].lo <= hi && hooks->list[ev][i].hi >= lo) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Calls every hook on the event whose address filter contains addr. */
+void
+hook_fire(Hooks* hooks, HOOK_EVENT ev, unsigned short addr, unsigned char data)
+{
+	int i;
+	HOOK* h;
+
+	for (i = 0; i < hooks->count[ev]; i++) {
+		h = &hooks->list[ev][i];
+		if (addr >= h->lo && addr <= h->hi) {
+			h->func(h->user, ev, addr, data);
+		}
+	}
+}
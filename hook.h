@@ -0,0 +1,58 @@
+#ifndef HOOK_H
+#define HOOK_H
+
+/* 
+ * Hook registry for tooling callbacks.
+ * Every event class keeps a bit in the mask so the run loop can test for
+ * "any hooks?" with a single branch and skip everything else when unused.
+ */
+#define HOOK_MAX 16 /* callbacks per event */
+
+typedef enum hookEvent HOOK_EVENT;
+
+/*
+ * Event arguments passed to the callback:
+ *   HOOK_EXEC   addr = pc of the instruction, data = opcode
+ *   HOOK_READ   addr = address read, data = value read
+ *   HOOK_WRITE  addr = address written, data = value written
+ *               (internal RAM mirrors report the $0000-$07FF address)
+ *   HOOK_IRQ    addr = interrupt vector ($FFFA NMI, $FFFE IRQ), data = pushed status
+ *   HOOK_FRAME  addr = 0, data = 0
+ */
+enum hookEvent {
+	HOOK_EXEC,   /* Instruction execute */
+	HOOK_READ,   /* Memory read */
+	HOOK_WRITE,  /* Memory write */
+	HOOK_IRQ,    /* Interrupt entry */
+	HOOK_FRAME,  /* Frame end */
+	HOOK_EVENTS
+};
+
+typedef void (*hookFunc)(void* user, HOOK_EVENT ev, unsigned short addr, unsigned char data);
+
+typedef struct hook HOOK;
+typedef struct hooks Hooks;
+
+struct hook {
+	hookFunc func;
+	void* user;
+	unsigned short lo;  /* first address the hook fires on */
+	unsigned short hi;  /* last address the hook fires on */
+};
+
+struct hooks {
+	unsigned char mask;                 /* bit per event with a registered hook */
+	int count[HOOK_EVENTS];
+	HOOK list[HOOK_EVENTS][HOOK_MAX];
+};
+
+/* Tests whether any hook is registered for the event. */
+#define HOOK_ACTIVE(h, ev) ((h)->mask & (1 << (ev)))
+
+void hook_clear(Hooks* hooks);
+int hook_add(Hooks* hooks, HOOK_EVENT ev, hookFunc func, void* user, unsigned short lo, unsigned short hi);
+void hook_remove(Hooks* hooks, HOOK_EVENT ev, hookFunc func, void* user);
+int hook_covers(Hooks* hooks, HOOK_EVENT ev, unsigned short lo, unsigned short hi);
+void hook_fire(Hooks* hooks, HOOK_EVENT ev, unsigned short addr, unsigned char data);
+
+#endif
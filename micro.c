@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "core.h"
+#include "micro.h"
+
+typedef struct op OP;
+typedef struct micro MICRO;
+
+/* An operation together with an opcode that uses it (cpu_fetch looks at the opcode) */
+struct op {
+	unsigned char (*operate)(CPU*);
+	unsigned char opcode;
+};
+
+struct micro {
+	const char* name;
+	void (*run)(const MICRO* m, long n);
+	unsigned char (*mode)(CPU*);  /* addressing mode under test */
+	const OP* ops;                /* operation group under test */
+	int count;                    /* calls per iteration */
+	int scale;                    /* iterations divided by this, for slow calls */
+};
+
+/* Machine the microbenchmarks run on */
+static Bus bus;
+static CPU cpu;
+static volatile unsigned char sink;
+
+/* Scratch operand bytes at $0200, zero page pointers at $10 */
+#define OPERANDS 0x0200
+#define ZP 0x10
+#define IO_PAGE 0x50
+
+static const OP loadStore[] = { { LDA, 0xA5 }, { STA, 0x85 }, { LDX, 0xA6 }, { STX, 0x86 } };
+static const OP alu[] = { { ADC, 0x65 }, { SBC, 0xE5 }, { AND, 0x25 }, { ORA, 0x05 }, { EOR, 0x45 }, { CMP, 0xC5 } };
+static const OP shift[] = { { ASL, 0x06 }, { LSR, 0x46 }, { ROL, 0x26 }, { ROR, 0x66 } };
+static const OP incDec[] = { { INC, 0xE6 }, { DEC, 0xC6 }, { INX, 0xE8 }, { DEY, 0x88 } };
+static const OP branch[] = { { BNE, 0xD0 }, { BEQ, 0xF0 }, { BCC, 0x90 }, { BCS, 0xB0 } };
+static const OP flags[] = { { CLC, 0x18 }, { SEC, 0x38 }, { CLV, 0xB8 }, { SEI, 0x78 } };
+static const OP transfer[] = { { TAX, 0xAA }, { TXA, 0x8A }, { TAY, 0xA8 }, { TSX, 0xBA } };
+static const OP stack[] = { { PHA, 0x48 }, { PLA, 0x68 }, { PHP, 0x08 }, { PLP, 0x28 } };
+static const OP jump[] = { { JSR, 0x20 }, { RTS, 0x60 }, { JMP, 0x4C } };
+
+static unsigned char
+noRead(void* user, unsigned short addr)
+{
+	(void)user;
+	return addr & 0xFF;
+}
+
+static void
+noWrite(void* user, unsigned short addr, unsigned char data)
+{
+	(void)user;
+	(void)addr;
+	(void)data;
+}
+
+/* Fresh machine with operands in place; pointers in zero page aim at $0200. */
+static void
+micro_setup()
+{
+	core_init(&bus, &cpu);
+	cpu_reset(&cpu);
+	cpu.cycles = 0;
+
+	core_load(&bus, OPERANDS, "10 02 00 02 F0 11 22 33");
+	core_load(&bus, ZP, "00 02 00 02");
+	bus_mapIO(&bus, IO_PAGE, noRead, noWrite, NULL);
+}
+
+/* Addressing mode with its operands loaded along with the opcode, as cpu_clock does */
+static void
+micro_mode(const MICRO* m, long n)
+{
+	unsigned char extra = 0;
+
+	for (; n > 0; n--) {
+		memcpy(cpu.prefetch, &bus.ram[OPERANDS - 1], 4);
+		cpu.prefetched = true;
+		cpu.pc = OPERANDS;
+		extra += m->mode(&cpu);
+	}
+	sink = extra + cpu.addr_abs;
+}
+
+/* Addressing mode reading its operands through the bus (page end, device or hooked page) */
+static void
+micro_modeBus(const MICRO* m, long n)
+{
+	unsigned char extra = 0;
+
+	for (; n > 0; n--) {
+		cpu.prefetched = false;
+		cpu.pc = OPERANDS;
+		extra += m->mode(&cpu);
+	}
+	sink = extra + cpu.addr_abs;
+}
+
+static void
+micro_ops(const MICRO* m, long n)
+{
+	const OP* ops = m->ops;
+	unsigned char extra = 0;
+	int i;
+
+	for (; n > 0; n--) {
+		for (i = 0; i < m->count; i++) {
+			cpu.opcode = ops[i].opcode;
+			cpu.pc = OPERANDS;
+			cpu.addr_abs = ZP;
+			cpu.addr_rel = 2;
+			extra += ops[i].operate(&cpu);
+		}
+	}
+	sink = extra + cpu.a;
+}
+
+static void
+micro_readRam(const MICRO* m, long n)
+{
+	unsigned char sum = 0;
+
+	(void)m;
+	for (; n > 0; n--) {
+		sum += bus_read(&bus, OPERANDS + (n & 0xFF));
+	}
+	sink = sum;
+}
+
+static void
+micro_readMirror(const MICRO* m, long n)
+{
+	unsigned char sum = 0;
+
+	(void)m;
+	for (; n > 0; n--) {
+		sum += bus_read(&bus, RAM_SIZE + OPERANDS + (n & 0xFF));
+	}
+	sink = sum;
+}
+
+static void
+micro_readIO(const MICRO* m, long n)
+{
+	unsigned char sum = 0;
+
+	(void)m;
+	for (; n > 0; n--) {
+		sum += bus_read(&bus, (IO_PAGE << PAGE_BITS) + (n & 0xFF));
+	}
+	sink = sum;
+}
+
+static void
+micro_writeRam(const MICRO* m, long n)
+{
+	(void)m;
+	for (; n > 0; n--) {
+		bus_write(&bus, OPERANDS + 0x100 + (n & 0xFF), n);
+	}
+}
+
+static void
+micro_writeIO(const MICRO* m, long n)
+{
+	(void)m;
+	for (; n > 0; n--) {
+		bus_write(&bus, (IO_PAGE << PAGE_BITS) + (n & 0xFF), n);
+	}
+}
+
+static void
+micro_reset(const MICRO* m, long n)
+{
+	(void)m;
+	for (; n > 0; n--) {
+		cpu_reset(&cpu);
+	}
+	sink = cpu.stkp;
+}
+
+static void
+micro_clearMem(const MICRO* m, long n)
+{
+	(void)m;
+	for (; n > 0; n--) {
+		bus_clearMem(&bus);
+	}
+	sink = bus.ram[0];
+	micro_setup();
+}
+
+#define MODE(name) { #name, micro_mode, name, NULL, 1, 1 }
+#define MODE_BUS(name) { #name " bus", micro_modeBus, name, NULL, 1, 1 }
+#define GROUP(name, ops) { name, micro_ops, NULL, ops, sizeof(ops) / sizeof(ops[0]), 1 }
+
+static const MICRO micros[] = {
+	MODE(IMP), MODE(IMM),
+	MODE(ZP0), MODE(ZPX),
+	MODE(ZPY), MODE(REL),
+	MODE(ABS), MODE(ABX),
+	MODE(ABY), MODE(IND),
+	MODE(IZX), MODE(IZY),
+
+	MODE_BUS(ZP0), MODE_BUS(ZPX),
+	MODE_BUS(ZPY), MODE_BUS(REL),
+	MODE_BUS(ABS), MODE_BUS(ABX),
+	MODE_BUS(ABY), MODE_BUS(IND),
+	MODE_BUS(IZX), MODE_BUS(IZY),
+
+	GROUP("load/store", loadStore),
+	GROUP("alu", alu),
+	GROUP("shift", shift),
+	GROUP("inc/dec", incDec),
+	GROUP("branch", branch),
+	GROUP("flags", flags),
+	GROUP("transfer", transfer),
+	GROUP("stack", stack),
+	GROUP("jump", jump),
+
+	{ "read ram", micro_readRam, NULL, NULL, 1, 1 },
+	{ "read mirror", micro_readMirror, NULL, NULL, 1, 1 },
+	{ "read io", micro_readIO, NULL, NULL, 1, 1 },
+	{ "write ram", micro_writeRam, NULL, NULL, 1, 1 },
+	{ "write io", micro_writeIO, NULL, NULL, 1, 1 },
+
+	{ "cpu_reset", micro_reset, NULL, NULL, 1, 1 },
+	{ "bus_clearMem", micro_clearMem, NULL, NULL, 1, 1000 },
+};
+
+#define MICROS (int)(sizeof(micros) / sizeof(micros[0]))
+
+static double
+micro_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int
+micro_compare(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Times one microbenchmark and prints its summary row. */
+static void
+micro_time(const MICRO* m, int reps, long iters)
+{
+	double* ns = malloc(reps * sizeof(double));
+	double start, mean = 0, var = 0;
+	long n = iters / m->scale;
+	int r;
+
+	if (ns == NULL || n < 1) {
+		free(ns);
+		return;
+	}
+
+	micro_setup();
+
+	/* warmup: caches, branch predictors, page faults */
+	m->run(m, n);
+
+	for (r = 0; r < reps; r++) {
+		start = micro_now();
+		m->run(m, n);
+		ns[r] = (micro_now() - start) / ((double)n * m->count);
+		mean += ns[r];
+	}
+	mean /= reps;
+
+	for (r = 0; r < reps; r++) {
+		var += (ns[r] - mean) * (ns[r] - mean);
+	}
+
+	qsort(ns, reps, sizeof(double), micro_compare);
+	printf("%-14s %9.2f %9.2f %9.2f %9.2f\n", m->name, ns[0], ns[reps / 2], mean, sqrt(var / reps));
+
+	free(ns);
+}
+
+/*
+ * Runs the microbenchmarks named in names, or all when count is 0.
+ * returns the number run
+ */
+int
+micro_run(int reps, long iters, int count, char** names)
+{
+	int ran = 0;
+	int i, j;
+
+	if (reps < 1) {
+		reps = 1;
+	}
+
+	printf("%-14s %9s %9s %9s %9s   (ns per call, %d runs)\n", "micro", "min", "median", "mean", "stddev", reps);
+
+	for (i = 0; i < MICROS; i++) {
+		for (j = 0; j < count && strcmp(names[j], micros[i].name) != 0; j++);
+		if (count > 0 && j == count) {
+			continue;
+		}
+
+		micro_time(&micros[i], reps, iters);
+		ran++;
+	}
+
+	return ran;
+}
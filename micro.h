@@ -0,0 +1,16 @@
+#ifndef MICRO_H
+#define MICRO_H
+
+/*
+ * Microbenchmarks for the bench harness.
+ * Each one times a single piece of the interpreter in isolation
+ * (an addressing mode, a group of operations, one bus path, reset)
+ * over repeated runs after a warmup, and reports ns per call as
+ * min / median / mean / standard deviation.
+ */
+#define MICRO_REPS 11
+#define MICRO_ITERS 1000000
+
+int micro_run(int reps, long iters, int count, char** names);
+
+#endif
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "core.h"
+#include "nsf.h"
+#include "probe.h"
+
+/* Copies a fixed size, possibly unterminated header string. */
+static void
+nsf_text(char* out, const unsigned char* in)
+{
+	memcpy(out, in, 32);
+	out[32] = '\0';
+}
+
+/*
+ * Reads and parses an NSF file.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+nsf_load(Nsf* nsf, const char* path)
+{
+	unsigned char header[NSF_HEADER];
+	unsigned char* data;
+	long size;
+	int offset;
+	int i;
+	FILE* file = fopen(path, "rb");
+
+	memset(nsf, 0, sizeof(Nsf));
+
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	if (fread(header, 1, NSF_HEADER, file) != NSF_HEADER || memcmp(header, "NESM\x1A", 5) != 0) {
+		fprintf(stderr, "%s: not an NSF file\n", path);
+		fclose(file);
+		return 0;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file) - NSF_HEADER;
+	fseek(file, NSF_HEADER, SEEK_SET);
+
+	nsf->songs = header[0x06];
+	nsf->start = header[0x07];
+	nsf->load = header[0x08] | (header[0x09] << 8);
+	nsf->init = header[0x0A] | (header[0x0B] << 8);
+	nsf->play = header[0x0C] | (header[0x0D] << 8);
+	nsf_text(nsf->title, &header[0x0E]);
+	nsf_text(nsf->artist, &header[0x2E]);
+	nsf_text(nsf->copyright, &header[0x4E]);
+	nsf->speed = header[0x6E] | (header[0x6F] << 8);
+
+	for (i = 0; i < 8; i++) {
+		nsf->banks[i] = header[0x70 + i];
+		nsf->banked |= nsf->banks[i] != 0;
+	}
+
+	if (size <= 0 || nsf->load < 0x8000 || nsf->songs == 0) {
+		fprintf(stderr, "%s: unsupported NSF layout\n", path);
+		fclose(file);
+		return 0;
+	}
+
+	/*
+	 * Banked files are padded by the load address within a bank.
+	 * Plain files are laid out from $8000 and use banks 0-7 in order.
+	 */
+	offset = nsf->banked ? (nsf->load & (NSF_BANK - 1)) : (nsf->load - 0x8000);
+	if (!nsf->banked) {
+		for (i = 0; i < 8; i++) {
+			nsf->banks[i] = i;
+		}
+	}
+
+	nsf->nbanks = (offset + size + NSF_BANK - 1) / NSF_BANK;
+	if (nsf->nbanks < 8) {
+		nsf->nbanks = 8;
+	}
+
+	data = calloc(nsf->nbanks, NSF_BANK);
+	if (data == NULL || fread(data + offset, 1, size, file) != (size_t)size) {
+		fprintf(stderr, "%s: could not read program data\n", path);
+		free(data);
+		fclose(file);
+		return 0;
+	}
+	fclose(file);
+
+	nsf->image = data;
+	if (nsf->speed == 0) {
+		nsf->speed = 16639;
+	}
+
+	return 1;
+}
+
+void
+nsf_free(Nsf* nsf)
+{
+	free(nsf->image);
+	nsf->image = NULL;
+}
+
+/* Points the 4 KB slot at $8000 + slot * 4 KB at the input bank. */
+static void
+nsf_bank(NsfPlayer* player, int slot, int bank)
+{
+	unsigned char* mem = player->nsf->image + (bank % player->nsf->nbanks) * NSF_BANK;
+	int first = (0x8000 + slot * NSF_BANK) >> PAGE_BITS;
+	int i;
+
+	PROBE2(bank, slot, bank);
+
+	for (i = 0; i < NSF_BANK >> PAGE_BITS; i++) {
+		bus_mapPage(&player->bus, first + i, mem + (i << PAGE_BITS));
+	}
+}
+
+/* $5Fxx and ROM write handler: bank switching, ROM stays untouched */
+static void
+nsf_write(void* user, unsigned short addr, unsigned char data)
+{
+	NsfPlayer* player = user;
+
+	if (addr >= 0x8000) {
+		return;
+	}
+
+	if (addr >= 0x5FF8) {
+		nsf_bank(player, addr - 0x5FF8, data);
+	}
+	player->bus.page[addr >> PAGE_BITS][addr & (PAGE_BYTES - 1)] = data;
+}
+
+/* PLAY timer */
+static void
+nsf_due(void* user, unsigned long long when)
+{
+	NsfPlayer* player = user;
+
+	player->due = 1;
+	sched_add(&player->bus.sched, when + player->period, nsf_due, player);
+}
+
+/*
+ * Calls a routine and runs it until it returns into NSF_RETURN.
+ * returns 1 on success
+ * returns 0 if it did not return within NSF_CALL_LIMIT cycles
+ */
+static int
+nsf_call(NsfPlayer* player, unsigned short addr)
+{
+	CPU* cpu = &player->cpu;
+	unsigned short ret = NSF_RETURN - 1;
+	long ran = 0;
+
+	bus_write(&player->bus, 0x0100 + cpu->stkp--, ret >> 8);
+	bus_write(&player->bus, 0x0100 + cpu->stkp--, ret & 0xFF);
+	cpu->pc = addr;
+
+	if (cpu->prof != NULL) {
+		prof_call(cpu->prof, PROF_CALL, addr, cpu->stkp + 2, cpu->clocks);
+	}
+
+	while (cpu->pc != NSF_RETURN && ran < NSF_CALL_LIMIT) {
+		ran += core_step(cpu);
+	}
+
+	return cpu->pc == NSF_RETURN;
+}
+
+/*
+ * Sets up a fresh machine for the input song (0 based) and runs INIT.
+ * Synthesis runs inline; take samples with apu_samples after each tick.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+nsf_start(NsfPlayer* player, const Nsf* nsf, int song)
+{
+	Bus* bus = &player->bus;
+	CPU* cpu = &player->cpu;
+	int i;
+
+	player->nsf = nsf;
+	player->due = 0;
+	player->period = (unsigned long long)nsf->speed * APU_CLOCK / 1000000;
+
+	core_init(bus, cpu);
+	cpu->prof = player->prof;
+
+	/* ROM pages read straight from the shared image */
+	for (i = 0x80; i < PAGE_COUNT; i++) {
+		bus_mapIO(bus, i, NULL, nsf_write, player);
+	}
+	bus_mapIO(bus, 0x5F, NULL, nsf_write, player);
+	for (i = 0; i < 8; i++) {
+		nsf_bank(player, i, nsf->banks[i]);
+	}
+
+	/* JMP NSF_RETURN */
+	bus->ram[NSF_RETURN] = 0x4C;
+	bus->ram[NSF_RETURN + 1] = NSF_RETURN & 0xFF;
+	bus->ram[NSF_RETURN + 2] = NSF_RETURN >> 8;
+
+	cpu_reset(cpu);
+
+	if (!apu_init(&player->apu, cpu, 0)) {
+		return 0;
+	}
+
+	for (i = 0x4000; i <= 0x4013; i++) {
+		bus_write(bus, i, 0x00);
+	}
+	bus_write(bus, 0x4015, 0x0F);
+	bus_write(bus, 0x4017, 0x40);
+
+	cpu->a = song;
+	cpu->x = 0; /* NTSC */
+
+	if (!nsf_call(player, nsf->init)) {
+		fprintf(stderr, "NSF INIT did not return\n");
+		apu_close(&player->apu);
+		return 0;
+	}
+
+	sched_add(&bus->sched, cpu->clocks + player->period, nsf_due, player);
+	return 1;
+}
+
+/*
+ * Calls PLAY, then moves guest time on to the next PLAY call.
+ * Nothing runs between calls, so the idle loop is skipped by jumping
+ * from one scheduled event to the next instead of being emulated.
+ * returns 1 on success
+ * returns 0 if PLAY hung
+ */
+int
+nsf_tick(NsfPlayer* player)
+{
+	Bus* bus = &player->bus;
+	CPU* cpu = &player->cpu;
+
+	if (!nsf_call(player, player->nsf->play)) {
+		return 0;
+	}
+
+	while (!player->due) {
+		cpu->clocks = bus->sched.next;
+		sched_run(&bus->sched, cpu->clocks);
+	}
+	player->due = 0;
+
+	return 1;
+}
+
+void
+nsf_stop(NsfPlayer* player)
+{
+	apu_close(&player->apu);
+}
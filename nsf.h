@@ -0,0 +1,56 @@
+#ifndef NSF_H
+#define NSF_H
+
+#include "cpu.h"
+#include "apu.h"
+
+/*
+ * NSF music files.
+ * The parsed file is read only after nsf_load, so any number of players
+ * (one per thread) can share it. ROM pages are mapped straight from the
+ * file image with writes trapped, and bank switching at $5FF8-$5FFF only
+ * repoints page table entries.
+ */
+#define NSF_HEADER 0x80
+#define NSF_BANK 4096
+#define NSF_RETURN 0x4100      /* idle loop INIT/PLAY return into */
+#define NSF_CALL_LIMIT 1000000 /* cycles before a routine counts as hung */
+
+typedef struct nsf Nsf;
+typedef struct nsfPlayer NsfPlayer;
+
+struct nsf {
+	char title[33];
+	char artist[33];
+	char copyright[33];
+	unsigned char songs;
+	unsigned char start;       /* first song, 1 based */
+	unsigned short load;
+	unsigned short init;
+	unsigned short play;
+	unsigned short speed;      /* NTSC PLAY period in microseconds */
+	unsigned char banks[8];    /* initial banks for $8000-$FFFF */
+	int banked;
+
+	unsigned char* image;      /* program data in whole banks */
+	int nbanks;
+};
+
+struct nsfPlayer {
+	const Nsf* nsf;
+	Bus bus;
+	CPU cpu;
+	Apu apu;
+
+	unsigned long long period; /* CPU cycles between PLAY calls */
+	int due;                   /* PLAY is due */
+	Prof* prof;                /* call profiler to attach, or NULL */
+};
+
+int nsf_load(Nsf* nsf, const char* path);
+void nsf_free(Nsf* nsf);
+int nsf_start(NsfPlayer* player, const Nsf* nsf, int song);
+int nsf_tick(NsfPlayer* player);
+void nsf_stop(NsfPlayer* player);
+
+#endif
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "core.h"
+#include "nsf.h"
+#include "trace.h"
+#include "probe.h"
+
+/*
+ * Headless NSF renderer.
+ * Renders tracks to 16-bit mono WAV (or raw PCM) as fast as the core
+ * runs. With more than one job, each worker thread renders whole tracks
+ * on its own machine, so album renders scale with cores.
+ */
+void usage(char* program);
+
+/* macros */
+#define CHUNK 4096            /* samples taken from the APU at a time */
+#define DEFAULT_SECONDS 150
+
+typedef struct job JOB;
+
+struct job {
+	const Nsf* nsf;
+	const char* out;       /* output file, or prefix with several tracks */
+	const char* profile;   /* folded stacks file, or prefix; NULL when off */
+	int raw;
+	int seconds;
+	int first;             /* tracks first..last, 0 based */
+	int last;
+	atomic_int next;       /* next track to take */
+};
+
+/* Writes a little-endian value of the input size. */
+static void
+putLE(FILE* file, unsigned int value, int bytes)
+{
+	for (; bytes > 0; bytes--, value >>= 8) {
+		fputc(value & 0xFF, file);
+	}
+}
+
+/* Writes a WAV header for the input number of data bytes. */
+static void
+writeWavHeader(FILE* file, unsigned int bytes)
+{
+	fwrite("RIFF", 1, 4, file);
+	putLE(file, 36 + bytes, 4);
+	fwrite("WAVEfmt ", 1, 8, file);
+	putLE(file, 16, 4);
+	putLE(file, 1, 2);            /* PCM */
+	putLE(file, 1, 2);            /* mono */
+	putLE(file, APU_RATE, 4);
+	putLE(file, APU_RATE * 2, 4);
+	putLE(file, 2, 2);
+	putLE(file, 16, 2);
+	fwrite("data", 1, 4, file);
+	putLE(file, bytes, 4);
+}
+
+static double
+now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * Writes a track's call profile as folded stacks, and with a single track
+ * also prints the routines taking the most cycles.
+ */
+static void
+writeProfile(JOB* job, int track, Prof* prof, unsigned long frames)
+{
+	char path[FILENAME_MAX];
+
+	if (job->first == job->last) {
+		snprintf(path, sizeof(path), "%s", job->profile);
+	} else {
+		snprintf(path, sizeof(path), "%s-%02d.folded", job->profile, track + 1);
+	}
+
+	if (job->first == job->last) {
+		prof_report(prof, stdout, frames, 15);
+	}
+	prof_write(prof, path);
+}
+
+/*
+ * Renders one track to its output file.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+static int
+renderTrack(JOB* job, int track)
+{
+	char path[FILENAME_MAX];
+	short chunk[CHUNK];
+	long want = (long)job->seconds * APU_RATE;
+	long done = 0;
+	double start = now();
+	double took;
+	unsigned long long span = trace_begin();
+	unsigned long long step;
+	NsfPlayer* player;
+	Prof* prof = NULL;
+	FILE* file;
+	int n;
+
+	if (job->first == job->last) {
+		snprintf(path, sizeof(path), "%s", job->out);
+	} else {
+		snprintf(path, sizeof(path), "%s-%02d.%s", job->out, track + 1, job->raw ? "pcm" : "wav");
+	}
+
+	/* too big for a worker's stack */
+	player = malloc(sizeof(NsfPlayer));
+	if (player == NULL) {
+		perror("nsfplay");
+		return 0;
+	}
+
+	file = fopen(path, "wb");
+	if (file == NULL) {
+		perror(path);
+		free(player);
+		return 0;
+	}
+
+	if (!job->raw) {
+		writeWavHeader(file, 0);
+	}
+
+	if (job->profile != NULL) {
+		prof = malloc(sizeof(Prof));
+		if (prof != NULL) {
+			prof_init(prof, 0);
+		}
+	}
+	player->prof = prof;
+
+	PROBE1(job_start, track);
+
+	if (!nsf_start(player, job->nsf, track)) {
+		/* no audio was rendered, don't leave a header-only file that looks valid */
+		fclose(file);
+		remove(path);
+		free(player);
+		free(prof);
+		return 0;
+	}
+
+	while (done < want) {
+		step = trace_begin();
+		if (!nsf_tick(player)) {
+			fprintf(stderr, "track %d: PLAY did not return\n", track + 1);
+			break;
+		}
+		trace_end("play", step);
+
+		step = trace_begin();
+		while ((n = apu_samples(&player->apu, chunk, CHUNK)) > 0) {
+			if (n > want - done) {
+				n = want - done;
+			}
+			fwrite(chunk, sizeof(short), n, file);
+			done += n;
+		}
+		trace_end("write", step);
+	}
+
+	if (prof != NULL) {
+		prof_sync(prof, player->cpu.clocks);
+		writeProfile(job, track, prof, player->bus.frames);
+		free(prof);
+	}
+
+	nsf_stop(player);
+	free(player);
+	PROBE2(job_end, track, done);
+
+	if (!job->raw) {
+		fseek(file, 0, SEEK_SET);
+		writeWavHeader(file, done * sizeof(short));
+	}
+	fclose(file);
+	trace_end("track", span);
+
+	took = now() - start;
+	printf("track %2d: %s, %.1f s in %.2f s (%.0fx real time)\n",
+		track + 1, path, (double)done / APU_RATE, took, took > 0 ? done / (took * APU_RATE) : 0);
+
+	return 1;
+}
+
+/* Worker thread: renders tracks until none are left. */
+static void*
+worker(void* data)
+{
+	JOB* job = data;
+	int track;
+
+	trace_thread("worker");
+
+	while ((track = atomic_fetch_add(&job->next, 1)) <= job->last) {
+		renderTrack(job, track);
+	}
+
+	return NULL;
+}
+
+/*
+ * Usage Function
+ * Called when something isn't right with the command line parameters.
+ */
+void
+usage(char* program)
+{
+	printf("Usage: %s \n[--track n | --all] [--length seconds] [--jobs n] [--raw] \n[--out file-or-prefix] [--trace file.json] [--profile file-or-prefix] file.nsf\n", program);
+}
+
+int
+main(int argc, char* argv[])
+{
+	Nsf nsf;
+	JOB job;
+	pthread_t threads[64];
+	int jobs = 1;
+	int track = 0;
+	int all = 0;
+	int started;
+	double start;
+	char* traceFile = NULL;
+
+	/* Params for getopt */
+	int ch;
+	int option_index = 0;
+
+	/* Defines the options and their long/short equivalents. */
+	struct option longopts[] = {
+		{ "track", required_argument, NULL, 't'},
+		{ "all", no_argument, NULL, 'a'},
+		{ "length", required_argument, NULL, 'l'},
+		{ "jobs", required_argument, NULL, 'j'},
+		{ "out", required_argument, NULL, 'o'},
+		{ "raw", no_argument, NULL, 'r'},
+		{ "trace", required_argument, NULL, 'T'},
+		{ "profile", required_argument, NULL, 'P'},
+		{ "help", no_argument, NULL, 'h'},
+		{ NULL, 0, NULL, 0 }
+	};
+
+	memset(&job, 0, sizeof(job));
+	job.seconds = DEFAULT_SECONDS;
+	job.out = NULL;
+
+	/* Processes the command-line parameters */
+	while ((ch = getopt_long(argc, argv, "t:al:j:o:rT:P:h", longopts, &option_index)) != -1) {
+		switch (ch) {
+
+			case 't':
+				track = atoi(optarg);
+				break;
+
+			case 'a':
+				all = 1;
+				break;
+
+			case 'l':
+				job.seconds = atoi(optarg);
+				break;
+
+			case 'j':
+				jobs = atoi(optarg);
+				break;
+
+			case 'o':
+				job.out = optarg;
+				break;
+
+			case 'r':
+				job.raw = 1;
+				break;
+
+			case 'T':
+				traceFile = optarg;
+				break;
+
+			case 'P':
+				job.profile = optarg;
+				break;
+
+			case 'h':
+				printf("Renders NSF tracks to WAV, or raw 16-bit mono PCM with -r, at %d Hz.\nSeveral tracks go to <out>-NN.wav; -j renders that many tracks in parallel.\n--profile writes guest cycles per call path as folded stacks for flame graphs.\n\n", APU_RATE);
+				usage(argv[0]);
+				return 0;
+
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (!nsf_load(&nsf, argv[optind])) {
+		return 1;
+	}
+
+	printf("%s - %s (%s), %d track(s)\n", nsf.title, nsf.artist, nsf.copyright, nsf.songs);
+
+	if (all) {
+		job.first = 0;
+		job.last = nsf.songs - 1;
+	} else {
+		job.first = job.last = (track > 0 ? track : nsf.start) - 1;
+	}
+
+	if (job.first < 0 || job.last >= nsf.songs) {
+		fprintf(stderr, "track out of range\n");
+		nsf_free(&nsf);
+		return 1;
+	}
+
+	if (job.out == NULL) {
+		job.out = (job.first == job.last) ? (job.raw ? "track.pcm" : "track.wav") : "track";
+	}
+
+	if (jobs < 1) jobs = 1;
+	if (jobs > 64) jobs = 64;
+
+	job.nsf = &nsf;
+	atomic_store(&job.next, job.first);
+
+	if (traceFile != NULL) {
+		trace_start();
+	}
+
+	start = now();
+
+	for (started = 0; started < jobs; started++) {
+		if (pthread_create(&threads[started], NULL, worker, &job) != 0) {
+			perror("nsfplay");
+			break;
+		}
+	}
+
+	/* no thread could be started, render here */
+	if (started == 0) {
+		worker(&job);
+	}
+
+	while (started > 0) {
+		pthread_join(threads[--started], NULL);
+	}
+
+	printf("done in %.2f s\n", now() - start);
+
+	if (traceFile != NULL && trace_write(traceFile)) {
+		printf("trace written to %s\n", traceFile);
+	}
+
+	nsf_free(&nsf);
+	return 0;
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "perf.h"
+
+static const char* spanNames[PERF_SPANS] = { "cpu", "bus", "apu", "draw", "present" };
+
+void
+perf_init(Perf* perf)
+{
+	memset(perf, 0, sizeof(Perf));
+	perf->lastTime = perf_now();
+}
+
+/* returns monotonic host time in nanoseconds */
+unsigned long long
+perf_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Adds the time since start to a span kind. */
+void
+perf_add(Perf* perf, PERF_SPAN span, unsigned long long start)
+{
+	atomic_fetch_add_explicit(&perf->ns[span], perf_now() - start, memory_order_relaxed);
+}
+
+/*
+ * Closes an emulated frame that started at start and records the
+ * guest counters it ended at.
+ */
+void
+perf_frame(Perf* perf, unsigned long long start, unsigned long long clocks, unsigned long long instructions)
+{
+	unsigned long long took = perf_now() - start;
+	unsigned int frame = atomic_load_explicit(&perf->frames, memory_order_relaxed);
+
+	atomic_fetch_add_explicit(&perf->ns[PERF_CPU], took, memory_order_relaxed);
+	atomic_store_explicit(&perf->frameNs[frame & (PERF_HISTORY - 1)], took, memory_order_relaxed);
+	atomic_store_explicit(&perf->frames, frame + 1, memory_order_relaxed);
+	atomic_store_explicit(&perf->clocks, clocks, memory_order_relaxed);
+	atomic_store_explicit(&perf->instructions, instructions, memory_order_relaxed);
+}
+
+static int
+perf_compare(const void* a, const void* b)
+{
+	unsigned int x = *(const unsigned int*)a;
+	unsigned int y = *(const unsigned int*)b;
+
+	return (x > y) - (x < y);
+}
+
+/* Reports what changed since the previous report. */
+void
+perf_report(Perf* perf, PerfReport* report)
+{
+	unsigned int times[PERF_HISTORY];
+	unsigned long long now = perf_now();
+	unsigned long long wall = now - perf->lastTime;
+	unsigned long long value;
+	unsigned int frames = atomic_load_explicit(&perf->frames, memory_order_relaxed);
+	int count = frames < PERF_HISTORY ? frames : PERF_HISTORY;
+	int i;
+
+	memset(report, 0, sizeof(PerfReport));
+	if (wall == 0) {
+		return;
+	}
+
+	value = atomic_load_explicit(&perf->clocks, memory_order_relaxed);
+	report->mhz = (value - perf->lastClocks) * 1000.0 / wall;
+	perf->lastClocks = value;
+
+	value = atomic_load_explicit(&perf->instructions, memory_order_relaxed);
+	report->ips = (value - perf->lastInstructions) * 1e9 / wall;
+	perf->lastInstructions = value;
+
+	for (i = 0; i < PERF_SPANS; i++) {
+		value = atomic_load_explicit(&perf->ns[i], memory_order_relaxed);
+		report->share[i] = (value - perf->lastNs[i]) * 100.0 / wall;
+		perf->lastNs[i] = value;
+	}
+	report->share[PERF_CPU] -= report->share[PERF_BUS];
+
+	for (i = 0; i < count; i++) {
+		times[i] = atomic_load_explicit(&perf->frameNs[i], memory_order_relaxed);
+	}
+	if (count > 0) {
+		qsort(times, count, sizeof(unsigned int), perf_compare);
+		report->p50 = times[count * 50 / 100] / 1e6;
+		report->p95 = times[count * 95 / 100] / 1e6;
+		report->p99 = times[count * 99 / 100] / 1e6;
+	}
+
+	perf->lastTime = now;
+}
+
+/*
+ * Formats a report as one line.
+ * returns the length of the line
+ */
+int
+perf_format(PerfReport* report, char* out, int size)
+{
+	int n;
+	int i;
+
+	n = snprintf(out, size, "%.2f MHz %.2f MIPS frame %.2f/%.2f/%.2f ms",
+		report->mhz, report->ips / 1e6, report->p50, report->p95, report->p99);
+
+	for (i = 0; i < PERF_SPANS && n < size; i++) {
+		n += snprintf(out + n, size - n, " %s %.0f%%", spanNames[i], report->share[i]);
+	}
+
+	return n < size ? n : size - 1;
+}
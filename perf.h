@@ -0,0 +1,61 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdatomic.h>
+
+/*
+ * Host performance counters.
+ * Code brackets its work with perf_now() and perf_add(), which adds the
+ * elapsed monotonic time to that subsystem's total. Each span kind is
+ * only added to from one thread, so the totals are relaxed atomics the
+ * UI thread can sample without locks. perf_report turns the change since
+ * the previous report into rates and shares of wall time.
+ *
+ * PERF_CPU covers whole emulated frames, so it includes PERF_BUS (device
+ * register handlers) and inline APU synthesis; reports subtract the bus
+ * time from it.
+ */
+#define PERF_HISTORY 256 /* frame times kept for percentiles, power of two */
+
+typedef enum perfSpan PERF_SPAN;
+typedef struct perf Perf;
+typedef struct perfReport PerfReport;
+
+enum perfSpan {
+	PERF_CPU,      /* emulation thread, per frame */
+	PERF_BUS,      /* device register handlers */
+	PERF_APU,      /* audio synthesis */
+	PERF_DRAW,     /* UI drawing */
+	PERF_PRESENT,  /* UI present / vsync wait */
+	PERF_SPANS
+};
+
+struct perf {
+	atomic_ullong ns[PERF_SPANS];         /* host time per span kind */
+	atomic_ullong clocks;                 /* guest cycles at the last frame end */
+	atomic_ullong instructions;           /* guest instructions at the last frame end */
+	atomic_uint frameNs[PERF_HISTORY];    /* host time of recent emulated frames */
+	atomic_uint frames;
+
+	/* previous report, only touched by the reporting thread */
+	unsigned long long lastNs[PERF_SPANS];
+	unsigned long long lastClocks;
+	unsigned long long lastInstructions;
+	unsigned long long lastTime;
+};
+
+struct perfReport {
+	double mhz;                 /* guest clock */
+	double ips;                 /* guest instructions per second */
+	double p50, p95, p99;       /* host frame time in ms */
+	double share[PERF_SPANS];   /* percent of wall time */
+};
+
+void perf_init(Perf* perf);
+unsigned long long perf_now();
+void perf_add(Perf* perf, PERF_SPAN span, unsigned long long start);
+void perf_frame(Perf* perf, unsigned long long start, unsigned long long clocks, unsigned long long instructions);
+void perf_report(Perf* perf, PerfReport* report);
+int perf_format(PerfReport* report, char* out, int size);
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef PROBE_H
+#define PROBE_H
+
+/*
+ * Static tracepoints (USDT) under the "emu" provider.
+ * With systemtap's sys/sdt.h available each probe compiles to a single
+ * nop plus a note in the ELF file, which bpftrace and perf can attach to
+ * without rebuilding:
+ *
+ *   bpftrace -e 'usdt:./emu:emu:frame_end { @[arg0 % 60] = count(); }'
+ *   perf buildid-cache --add ./emu && perf record -e sdt_emu:irq ...
+ *
+ * Without the header the probes compile to nothing.
+ *
+ *   frame_start(frame, clocks)       frame_end(frame, clocks)
+ *   insn(pc, opcode, clocks)         every PROBE_SAMPLE instructions
+ *   irq(vector, pc)                  NMI and IRQ entry
+ *   bank(slot, bank)                 NSF bank switch
+ *   sram_load(path)                  sram_save(sync)
+ *   job_start(track)                 job_end(track, samples)
+ */
+#define PROBE_SAMPLE 1024    /* power of two */
+
+#if defined(__has_include) && !defined(NO_PROBES)
+# if __has_include(<sys/sdt.h>)
+#  include <sys/sdt.h>
+#  define HAVE_PROBES 1
+# endif
+#endif
+
+#ifdef HAVE_PROBES
+# define PROBE1(name, a) STAP_PROBE1(emu, name, a)
+# define PROBE2(name, a, b) STAP_PROBE2(emu, name, a, b)
+# define PROBE3(name, a, b, c) STAP_PROBE3(emu, name, a, b, c)
+#else
+# define PROBE1(name, a) do { } while (0)
+# define PROBE2(name, a, b) do { } while (0)
+# define PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif
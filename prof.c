@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "prof.h"
+
+typedef struct profRow PROF_ROW;
+
+/* One routine in the flat report, summed over its call paths. */
+struct profRow {
+	unsigned int key;             /* kind << 16 | addr */
+	unsigned long calls;
+	unsigned long long self;
+	unsigned long long total;
+};
+
+/* Starts an empty profile at the input cycle. */
+void
+prof_init(Prof* prof, unsigned long long clocks)
+{
+	memset(prof, 0, sizeof(Prof));
+	prof->nodes[0].kind = PROF_ROOT;
+	prof->nodes[0].parent = -1;
+	prof->nodes[0].child = -1;
+	prof->nodes[0].sibling = -1;
+	prof->nnodes = 1;
+	prof->last = clocks;
+}
+
+/* Charges the cycles since the last event to the routine on top. */
+void
+prof_sync(Prof* prof, unsigned long long clocks)
+{
+	prof->nodes[prof->stack[prof->depth].node].self += clocks - prof->last;
+	prof->last = clocks;
+}
+
+/* Pops every frame whose return address sits at or below sp. */
+static void
+prof_pop(Prof* prof, int sp)
+{
+	while (prof->depth > 0 && prof->stack[prof->depth].sp <= sp) {
+		prof->depth--;
+	}
+}
+
+/*
+ * Enters a routine at addr. sp is the stack pointer before the return
+ * address was pushed.
+ */
+void
+prof_call(Prof* prof, PROF_KIND kind, unsigned short addr, unsigned char sp, unsigned long long clocks)
+{
+	PROF_NODE* node;
+	int parent, i;
+
+	prof_sync(prof, clocks);
+
+	/* frames the stack pointer has moved past were abandoned */
+	prof_pop(prof, sp + 1);
+
+	if (prof->depth + 1 >= PROF_DEPTH) {
+		prof->dropped++;
+		return;
+	}
+
+	parent = prof->stack[prof->depth].node;
+	for (i = prof->nodes[parent].child; i >= 0; i = prof->nodes[i].sibling) {
+		if (prof->nodes[i].addr == addr && prof->nodes[i].kind == kind) {
+			break;
+		}
+	}
+
+	if (i < 0) {
+		if (prof->nnodes >= PROF_NODES) {
+			prof->dropped++;
+			return;
+		}
+
+		i = prof->nnodes++;
+		node = &prof->nodes[i];
+		node->addr = addr;
+		node->kind = kind;
+		node->parent = parent;
+		node->child = -1;
+		node->sibling = prof->nodes[parent].child;
+		prof->nodes[parent].child = i;
+	}
+
+	prof->nodes[i].calls++;
+	prof->depth++;
+	prof->stack[prof->depth].node = i;
+	prof->stack[prof->depth].sp = sp;
+}
+
+/* Leaves routines after RTS / RTI; sp is the stack pointer after the pull. */
+void
+prof_return(Prof* prof, unsigned char sp, unsigned long long clocks)
+{
+	prof_sync(prof, clocks);
+	prof_pop(prof, sp);
+}
+
+/* Writes a node's name, e.g. $8040 or NMI $C000. */
+static int
+prof_name(const PROF_NODE* node, char* out, int size)
+{
+	switch (node->kind) {
+		case PROF_ROOT:
+			return snprintf(out, size, "main");
+		case PROF_IRQ:
+			return snprintf(out, size, "IRQ $%04X", node->addr);
+		case PROF_NMI:
+			return snprintf(out, size, "NMI $%04X", node->addr);
+		default:
+			return snprintf(out, size, "$%04X", node->addr);
+	}
+}
+
+/*
+ * Writes the profile as folded stacks, one line per call path with its
+ * exclusive cycles.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+prof_write(Prof* prof, const char* path)
+{
+	FILE* file = fopen(path, "w");
+	int chain[PROF_DEPTH + 1];
+	char name[16];
+	int i, n;
+
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	for (i = 0; i < prof->nnodes; i++) {
+		if (prof->nodes[i].self == 0) {
+			continue;
+		}
+
+		for (n = 0, chain[0] = i; chain[n] != 0 && n < PROF_DEPTH; n++) {
+			chain[n + 1] = prof->nodes[chain[n]].parent;
+		}
+
+		for (; n >= 0; n--) {
+			prof_name(&prof->nodes[chain[n]], name, sizeof(name));
+			fprintf(file, "%s%s", name, n > 0 ? ";" : "");
+		}
+		fprintf(file, " %llu\n", prof->nodes[i].self);
+	}
+
+	if (fclose(file) != 0) {
+		perror(path);
+		return 0;
+	}
+
+	return 1;
+}
+
+static int
+prof_byKey(const void* a, const void* b)
+{
+	const PROF_ROW* x = a;
+	const PROF_ROW* y = b;
+
+	return (x->key > y->key) - (x->key < y->key);
+}
+
+static int
+prof_byTotal(const void* a, const void* b)
+{
+	const PROF_ROW* x = a;
+	const PROF_ROW* y = b;
+
+	return (x->total < y->total) - (x->total > y->total);
+}
+
+/* returns 1 if a routine appears again above the node (recursion) */
+static int
+prof_recursive(Prof* prof, int i)
+{
+	const PROF_NODE* node = &prof->nodes[i];
+	int up;
+
+	for (up = node->parent; up > 0; up = prof->nodes[up].parent) {
+		if (prof->nodes[up].addr == node->addr && prof->nodes[up].kind == node->kind) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Prints the rows routines with the most inclusive cycles.
+ * With frames > 0 inclusive cycles are also shown per frame, to compare
+ * against the frame budget.
+ */
+void
+prof_report(Prof* prof, FILE* out, unsigned long frames, int rows)
+{
+	unsigned long long* total = malloc(prof->nnodes * sizeof(unsigned long long));
+	PROF_ROW* row = malloc(prof->nnodes * sizeof(PROF_ROW));
+	unsigned long long all = 0;
+	char name[16];
+	int i, n;
+
+	if (total == NULL || row == NULL) {
+		free(total);
+		free(row);
+		return;
+	}
+
+	/* children always come after their parent, so one backward pass sums subtrees */
+	for (i = 0; i < prof->nnodes; i++) {
+		total[i] = prof->nodes[i].self;
+		all += prof->nodes[i].self;
+	}
+	for (i = prof->nnodes - 1; i > 0; i--) {
+		total[prof->nodes[i].parent] += total[i];
+	}
+
+	for (i = 0; i < prof->nnodes; i++) {
+		row[i].key = (prof->nodes[i].kind << 16) | prof->nodes[i].addr;
+		row[i].calls = prof->nodes[i].calls;
+		row[i].self = prof->nodes[i].self;
+		row[i].total = prof_recursive(prof, i) ? 0 : total[i];
+	}
+
+	/* merge the call paths of each routine */
+	qsort(row, prof->nnodes, sizeof(PROF_ROW), prof_byKey);
+	for (i = 1, n = 0; i < prof->nnodes; i++) {
+		if (row[i].key == row[n].key) {
+			row[n].calls += row[i].calls;
+			row[n].self += row[i].self;
+			row[n].total += row[i].total;
+		} else {
+			row[++n] = row[i];
+		}
+	}
+	n++;
+	qsort(row, n, sizeof(PROF_ROW), prof_byTotal);
+
+	fprintf(out, "%-12s %9s %12s %6s %12s %6s", "routine", "calls", "inclusive", "%", "exclusive", "%");
+	if (frames > 0) {
+		fprintf(out, " %10s", "per frame");
+	}
+	fprintf(out, "\n");
+
+	for (i = 0; i < n && i < rows; i++) {
+		PROF_NODE node = { row[i].key & 0xFFFF, row[i].key >> 16, 0, 0, 0, 0, 0 };
+
+		prof_name(&node, name, sizeof(name));
+		fprintf(out, "%-12s %9lu %12llu %6.2f %12llu %6.2f", name, row[i].calls,
+			row[i].total, all ? 100.0 * row[i].total / all : 0,
+			row[i].self, all ? 100.0 * row[i].self / all : 0);
+		if (frames > 0) {
+			fprintf(out, " %10.0f", (double)row[i].total / frames);
+		}
+		fprintf(out, "\n");
+	}
+
+	if (prof->dropped > 0) {
+		fprintf(out, "%lu calls not tracked (deeper than %d or more than %d paths)\n",
+			prof->dropped, PROF_DEPTH, PROF_NODES);
+	}
+
+	free(total);
+	free(row);
+}
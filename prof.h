@@ -0,0 +1,69 @@
+#ifndef PROF_H
+#define PROF_H
+
+#include <stdio.h>
+
+/*
+ * Guest call-graph profiler.
+ * A shadow call stack follows JSR/RTS and interrupt entry/RTI, and guest
+ * cycles are charged to the call path that is on top of it: exclusively
+ * to the routine running, inclusively to every routine on the stack.
+ * Only the four call/return points touch the profiler, so instructions
+ * in between cost nothing extra.
+ *
+ * Returns are matched by stack pointer rather than by count: a return
+ * pops every frame whose return address it went past, so code that
+ * drops return addresses (PLA PLA / TXS) does not skew the stack.
+ *
+ * prof_write emits folded stacks for flamegraph.pl / speedscope:
+ *
+ *   main;$8040;$8200 1234
+ */
+#define PROF_NODES 4096  /* distinct call paths */
+#define PROF_DEPTH 64
+
+typedef enum profKind PROF_KIND;
+typedef struct profNode PROF_NODE;
+typedef struct profFrame PROF_FRAME;
+typedef struct prof Prof;
+
+enum profKind {
+	PROF_ROOT,
+	PROF_CALL,     /* JSR */
+	PROF_IRQ,      /* IRQ / BRK entry */
+	PROF_NMI,      /* NMI entry */
+};
+
+/* One call path: a routine reached through its parent's path. */
+struct profNode {
+	unsigned short addr;
+	unsigned char kind;
+	int parent;
+	int child;                    /* first child */
+	int sibling;                  /* next child of the parent */
+	unsigned long calls;
+	unsigned long long self;      /* exclusive cycles; inclusive is the subtree's sum */
+};
+
+struct profFrame {
+	int node;
+	unsigned char sp;             /* stack pointer before the call pushed */
+};
+
+struct prof {
+	PROF_NODE nodes[PROF_NODES];
+	int nnodes;
+	PROF_FRAME stack[PROF_DEPTH];
+	int depth;                    /* frames above the root */
+	unsigned long long last;      /* cycle the top frame was last charged to */
+	unsigned long dropped;        /* calls not tracked (depth or node limit) */
+};
+
+void prof_init(Prof* prof, unsigned long long clocks);
+void prof_call(Prof* prof, PROF_KIND kind, unsigned short addr, unsigned char sp, unsigned long long clocks);
+void prof_return(Prof* prof, unsigned char sp, unsigned long long clocks);
+void prof_sync(Prof* prof, unsigned long long clocks);
+int prof_write(Prof* prof, const char* path);
+void prof_report(Prof* prof, FILE* out, unsigned long frames, int rows);
+
+#endif
@@ -0,0 +1,91 @@
+#include "sched.h"
+
+#define NEVER (~0ULL)
+
+/* Recomputes the earliest pending event. */
+static void
+sched_update(Scheduler* sched)
+{
+	int i;
+
+	sched->next = NEVER;
+	for (i = 0; i < sched->count; i++) {
+		if (sched->list[i].when < sched->next) {
+			sched->next = sched->list[i].when;
+		}
+	}
+}
+
+/* Removes every pending event. */
+void
+sched_init(Scheduler* sched)
+{
+	sched->count = 0;
+	sched->next = NEVER;
+}
+
+/* 
+ * Registers a callback for the input cycle.
+ * returns 1 on success
+ * returns 0 if the scheduler is full
+ */
+int
+sched_add(Scheduler* sched, unsigned long long when, eventFunc func, void* user)
+{
+	EVENT* ev;
+
+	if (sched->count >= SCHED_MAX) {
+		return 0;
+	}
+
+	ev = &sched->list[sched->count++];
+	ev->when = when;
+	ev->func = func;
+	ev->user = user;
+
+	if (when < sched->next) {
+		sched->next = when;
+	}
+	return 1;
+}
+
+/* Removes pending events matching the callback and user pointer. */
+void
+sched_cancel(Scheduler* sched, eventFunc func, void* user)
+{
+	int i = 0;
+
+	while (i < sched->count) {
+		if (sched->list[i].func == func && sched->list[i].user == user) {
+			sched->list[i] = sched->list[--sched->count];
+		} else {
+			i++;
+		}
+	}
+
+	sched_update(sched);
+}
+
+/* 
+ * Fires every event due at or before now. Events are removed before
+ * their callback runs, so callbacks may reschedule themselves.
+ */
+void
+sched_run(Scheduler* sched, unsigned long long now)
+{
+	EVENT ev;
+	int i = 0;
+
+	while (i < sched->count) {
+		if (sched->list[i].when <= now) {
+			ev = sched->list[i];
+			sched->list[i] = sched->list[--sched->count];
+			ev.func(ev.user, ev.when);
+			i = 0;
+		} else {
+			i++;
+		}
+	}
+
+	sched_update(sched);
+}
@@ -0,0 +1,35 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+/*
+ * Cycle scheduler.
+ * Devices register a callback for the CPU cycle at which something will
+ * happen (frame end, a mapper IRQ counter reaching zero, ...) instead of
+ * being polled on every cycle or fetch. The run loop only compares the
+ * cycle counter against the earliest pending event.
+ */
+#define SCHED_MAX 16
+
+typedef void (*eventFunc)(void* user, unsigned long long when);
+
+typedef struct event EVENT;
+typedef struct scheduler Scheduler;
+
+struct event {
+	unsigned long long when;  /* CPU cycle the event is due */
+	eventFunc func;
+	void* user;
+};
+
+struct scheduler {
+	unsigned long long next;  /* earliest pending event */
+	int count;
+	EVENT list[SCHED_MAX];
+};
+
+void sched_init(Scheduler* sched);
+int sched_add(Scheduler* sched, unsigned long long when, eventFunc func, void* user);
+void sched_cancel(Scheduler* sched, eventFunc func, void* user);
+void sched_run(Scheduler* sched, unsigned long long now);
+
+#endif
@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "script.h"
+
+# define UNUSED(x) (void)(x)
+
+/* Operand kinds */
+enum { OP_LIT, OP_MEM, OP_REG, OP_VALUE, OP_FRAME };
+
+/* Registers */
+enum { REG_A, REG_X, REG_Y, REG_SP, REG_PC, REG_P };
+
+/* Statements */
+enum { ST_PRINT, ST_ASSERT, ST_QUIT };
+
+/* Comparisons */
+enum { CMP_NONE, CMP_EQ, CMP_NE, CMP_LT, CMP_GT, CMP_LE, CMP_GE };
+
+static const char* cmpNames[] = { "", "==", "!=", "<", ">", "<=", ">=" };
+static const char* regNames[] = { "a", "x", "y", "sp", "pc", "p" };
+
+/*
+ * Splits a line into whitespace separated tokens.
+ * Quoted strings are kept as one token including the quotes,
+ * a ';' starts a comment like in assembly source.
+ * returns the number of tokens
+ */
+static int
+script_tokenize(char* line, char** tokens, int max)
+{
+	int n = 0;
+
+	while (*line != '\0' && n < max) {
+		while (isspace((unsigned char)*line)) {
+			line++;
+		}
+
+		if (*line == '\0' || *line == ';') {
+			break;
+		}
+
+		tokens[n++] = line;
+
+		if (*line == '"') {
+			line = strchr(line + 1, '"');
+			if (line == NULL) {
+				return -1;
+			}
+			line++;
+		} else {
+			while (*line != '\0' && !isspace((unsigned char)*line)) {
+				line++;
+			}
+		}
+
+		if (*line != '\0') {
+			*line++ = '\0';
+		}
+	}
+
+	return n;
+}
+
+/*
+ * Parses one operand token.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+static int
+script_operand(const char* tok, OPERAND* op)
+{
+	unsigned int i;
+	char* end;
+
+	if (tok[0] == '$') {
+		op->kind = OP_MEM;
+		op->value = strtol(tok + 1, &end, 16);
+		return *end == '\0' && end != tok + 1;
+	}
+
+	if (tok[0] == '#') {
+		op->kind = OP_LIT;
+		if (tok[1] == '$') {
+			op->value = strtol(tok + 2, &end, 16);
+			return *end == '\0' && end != tok + 2;
+		}
+		op->value = strtol(tok + 1, &end, 10);
+		return *end == '\0' && end != tok + 1;
+	}
+
+	if (strcmp(tok, "value") == 0) {
+		op->kind = OP_VALUE;
+		return 1;
+	}
+
+	if (strcmp(tok, "frame") == 0) {
+		op->kind = OP_FRAME;
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(regNames) / sizeof(regNames[0]); i++) {
+		if (strcmp(tok, regNames[i]) == 0) {
+			op->kind = OP_REG;
+			op->value = i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Parses "lhs cmp rhs" starting at tokens[0].
+ * returns 1 on success
+ * returns 0 on fail
+ */
+static int
+script_condition(char** tokens, int n, CONDITION* cond)
+{
+	unsigned int i;
+
+	if (n < 3 || !script_operand(tokens[0], &cond->lhs) || !script_operand(tokens[2], &cond->rhs)) {
+		return 0;
+	}
+
+	for (i = CMP_EQ; i <= CMP_GE; i++) {
+		if (strcmp(tokens[1], cmpNames[i]) == 0) {
+			cond->cmp = i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Evaluates an operand against the current machine state. */
+static unsigned short
+script_eval(Script* script, OPERAND* op, unsigned char data)
+{
+	CPU* cpu = script->cpu;
+
+	switch (op->kind) {
+		case OP_LIT:
+			return op->value;
+
+		case OP_MEM:
+			return script->view[op->value >> PAGE_BITS][op->value & (PAGE_BYTES - 1)];
+
+		case OP_VALUE:
+			return data;
+
+		case OP_FRAME:
+			return (unsigned short)script->frame;
+
+		case OP_REG:
+			switch (op->value) {
+				case REG_A:  return cpu->a;
+				case REG_X:  return cpu->x;
+				case REG_Y:  return cpu->y;
+				case REG_SP: return cpu->stkp;
+				case REG_PC: return cpu->pc;
+				case REG_P:  return cpu->status;
+			}
+	}
+
+	return 0;
+}
+
+/* Returns 1 if the condition holds (or there is none). */
+static int
+script_test(Script* script, CONDITION* cond, unsigned char data)
+{
+	unsigned short l, r;
+
+	if (cond->cmp == CMP_NONE) {
+		return 1;
+	}
+
+	l = script_eval(script, &cond->lhs, data);
+	r = script_eval(script, &cond->rhs, data);
+
+	switch (cond->cmp) {
+		case CMP_EQ: return l == r;
+		case CMP_NE: return l != r;
+		case CMP_LT: return l < r;
+		case CMP_GT: return l > r;
+		case CMP_LE: return l <= r;
+		case CMP_GE: return l >= r;
+	}
+
+	return 0;
+}
+
+/* Hook entry point: runs every statement of a block. */
+static void
+script_run(void* user, HOOK_EVENT ev, unsigned short addr, unsigned char data)
+{
+	BLOCK* block = user;
+	Script* script = block->script;
+	STATEMENT* st;
+	int i, j;
+
+	UNUSED(ev);
+	UNUSED(addr);
+
+	for (i = block->first; i < block->first + block->count; i++) {
+		st = &script->stmts[i];
+
+		if (!script_test(script, &st->when, data)) {
+			continue;
+		}
+
+		switch (st->op) {
+			case ST_PRINT:
+				printf("%s", st->text);
+				for (j = 0; j < st->nargs; j++) {
+					printf(" $%02X", script_eval(script, &st->args[j], data));
+				}
+				printf("\n");
+				break;
+
+			case ST_ASSERT:
+				if (!script_test(script, &st->test, data)) {
+					fprintf(stderr, "%s:%d: assertion failed: $%02X %s $%02X (frame %lu)\n",
+						script->name, st->line,
+						script_eval(script, &st->test.lhs, data), cmpNames[st->test.cmp],
+						script_eval(script, &st->test.rhs, data), script->frame);
+					script->failures++;
+				}
+				break;
+
+			case ST_QUIT:
+				script->quit = 1;
+				break;
+		}
+	}
+}
+
+/* Counts frames so scripts can refer to them. */
+static void
+script_tick(void* user, HOOK_EVENT ev, unsigned short addr, unsigned char data)
+{
+	Script* script = user;
+
+	UNUSED(ev);
+	UNUSED(addr);
+	UNUSED(data);
+
+	script->frame++;
+}
+
+/*
+ * Parses a statement from the tokens.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+static int
+script_statement(char** tokens, int n, STATEMENT* st)
+{
+	int i;
+
+	memset(st, 0, sizeof(*st));
+
+	if (n >= 4 && strcmp(tokens[0], "if") == 0) {
+		if (!script_condition(tokens + 1, n - 1, &st->when)) {
+			return 0;
+		}
+		tokens += 4;
+		n -= 4;
+	}
+
+	if (n == 0) {
+		return 0;
+	}
+
+	if (strcmp(tokens[0], "quit") == 0 && n == 1) {
+		st->op = ST_QUIT;
+		return 1;
+	}
+
+	if (strcmp(tokens[0], "assert") == 0 && n == 4) {
+		st->op = ST_ASSERT;
+		return script_condition(tokens + 1, n - 1, &st->test);
+	}
+
+	if (strcmp(tokens[0], "print") == 0) {
+		st->op = ST_PRINT;
+		i = 1;
+
+		if (n > 1 && tokens[1][0] == '"') {
+			snprintf(st->text, sizeof(st->text), "%.*s", (int)strlen(tokens[1]) - 2, tokens[1] + 1);
+			i++;
+		}
+
+		for (; i < n; i++) {
+			if (st->nargs == SCRIPT_MAX_ARGS || !script_operand(tokens[i], &st->args[st->nargs++])) {
+				return 0;
+			}
+		}
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Parses an "on <event> [$addr]" line into a new block.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+static int
+script_block(Script* script, char** tokens, int n)
+{
+	BLOCK* block;
+	OPERAND where;
+
+	if (script->nblocks == SCRIPT_MAX_BLOCKS) {
+		return 0;
+	}
+
+	block = &script->blocks[script->nblocks];
+	block->script = script;
+	block->first = script->nstmts;
+	block->count = 0;
+	block->addr = 0;
+
+	if (n == 2 && strcmp(tokens[1], "frame") == 0) {
+		block->ev = HOOK_FRAME;
+	} else if (n == 3 && script_operand(tokens[2], &where) && where.kind == OP_MEM) {
+		block->addr = where.value;
+
+		if (strcmp(tokens[1], "exec") == 0) {
+			block->ev = HOOK_EXEC;
+		} else if (strcmp(tokens[1], "read") == 0) {
+			block->ev = HOOK_READ;
+		} else if (strcmp(tokens[1], "write") == 0) {
+			block->ev = HOOK_WRITE;
+		} else {
+			return 0;
+		}
+	} else {
+		return 0;
+	}
+
+	script->nblocks++;
+	return 1;
+}
+
+/*
+ * Compiles a script file and attaches its blocks to the CPU's bus.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+script_load(Script* script, const char* path, CPU* cpu)
+{
+	FILE* fp;
+	char line[256];
+	char* tokens[16];
+	int n, i, lineno = 0;
+	BLOCK* block;
+
+	memset(script, 0, sizeof(*script));
+	script->name = path;
+	script->cpu = cpu;
+	script->view = (const unsigned char* const*)cpu->bus->page;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		n = script_tokenize(line, tokens, 16);
+
+		if (n == 0) {
+			continue;
+		}
+
+		if (n > 0 && strcmp(tokens[0], "on") == 0) {
+			if (script_block(script, tokens, n)) {
+				continue;
+			}
+		} else if (n > 0 && script->nblocks > 0 && script->nstmts < SCRIPT_MAX_STMTS) {
+			if (script_statement(tokens, n, &script->stmts[script->nstmts])) {
+				script->stmts[script->nstmts++].line = lineno;
+				script->blocks[script->nblocks - 1].count++;
+				continue;
+			}
+		}
+
+		fprintf(stderr, "%s:%d: syntax error\n", path, lineno);
+		fclose(fp);
+		return 0;
+	}
+
+	fclose(fp);
+
+	/* attach through the hook API so unused events stay free */
+	if (!bus_hook(cpu->bus, HOOK_FRAME, script_tick, script, 0x0000, 0xFFFF)) {
+		fprintf(stderr, "%s: too many hooks\n", path);
+		return 0;
+	}
+
+	for (i = 0; i < script->nblocks; i++) {
+		block = &script->blocks[i];
+
+		if (block->ev == HOOK_FRAME) {
+			n = bus_hook(cpu->bus, block->ev, script_run, block, 0x0000, 0xFFFF);
+		} else {
+			n = bus_hook(cpu->bus, block->ev, script_run, block, block->addr, block->addr);
+		}
+
+		if (!n) {
+			fprintf(stderr, "%s: too many hooks\n", path);
+			script_unload(script);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* Detaches every block of the script from the bus. */
+void
+script_unload(Script* script)
+{
+	int i;
+	Bus* bus = script->cpu->bus;
+
+	for (i = 0; i < script->nblocks; i++) {
+		bus_unhook(bus, script->blocks[i].ev, script_run, &script->blocks[i]);
+	}
+	bus_unhook(bus, HOOK_FRAME, script_tick, script);
+}
@@ -0,0 +1,87 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "cpu.h"
+
+/*
+ * Automation scripts.
+ * A script is a list of event blocks, each holding statements:
+ *
+ *   ; fibonacci check
+ *   on frame
+ *     if $0F24 != #$37 print "fib(9) =" $0F24
+ *   on exec $8026
+ *     assert x <= #10
+ *   on write $00F1
+ *     print "F1 <-" value
+ *     if frame >= #600 quit
+ *
+ * Operands are $addr (RAM byte), #n / #$hex (literal), a x y sp pc p
+ * (registers), value (the byte the event carried) and frame (frame count).
+ * Statements are print, assert <cond>, quit, each optionally prefixed
+ * with if <cond>.
+ *
+ * Scripts are compiled once at load time and every block is attached
+ * through the hook API, so events a script does not use cost nothing.
+ */
+#define SCRIPT_MAX_STMTS 256
+#define SCRIPT_MAX_BLOCKS HOOK_MAX
+#define SCRIPT_MAX_ARGS 4
+#define SCRIPT_MAX_TEXT 48
+
+typedef struct operand OPERAND;
+typedef struct condition CONDITION;
+typedef struct statement STATEMENT;
+typedef struct block BLOCK;
+typedef struct script Script;
+
+struct operand {
+	unsigned char kind;   /* literal, memory, register, value or frame */
+	unsigned short value; /* literal value, address or register id */
+};
+
+struct condition {
+	unsigned char cmp;    /* comparison operator, 0 when unconditional */
+	OPERAND lhs;
+	OPERAND rhs;
+};
+
+struct statement {
+	unsigned char op;                /* print, assert or quit */
+	CONDITION when;                  /* optional if prefix */
+	CONDITION test;                  /* assert condition */
+	char text[SCRIPT_MAX_TEXT];      /* print label */
+	OPERAND args[SCRIPT_MAX_ARGS];   /* print operands */
+	unsigned char nargs;
+	int line;                        /* source line for messages */
+};
+
+struct block {
+	Script* script;
+	HOOK_EVENT ev;
+	unsigned short addr;
+	int first;   /* index of the first statement */
+	int count;   /* number of statements */
+};
+
+struct script {
+	const char* name;
+	CPU* cpu;
+
+	/* Read-only view of the bus page table */
+	const unsigned char* const* view;
+
+	STATEMENT stmts[SCRIPT_MAX_STMTS];
+	int nstmts;
+	BLOCK blocks[SCRIPT_MAX_BLOCKS];
+	int nblocks;
+
+	unsigned long frame;  /* frames seen since load */
+	int failures;         /* failed assertions */
+	int quit;             /* set by the quit statement */
+};
+
+int script_load(Script* script, const char* path, CPU* cpu);
+void script_unload(Script* script);
+
+#endif
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "perf.h"
+#include "trace.h"
+
+/* Process wide registry: tracing spans every thread of the process. */
+static atomic_int enabled;
+static unsigned long long origin;
+static _Atomic(TraceBuffer*) buffers[TRACE_THREADS];
+static atomic_int nbuffers;
+static _Thread_local TraceBuffer* local;
+
+/* Starts recording. */
+void
+trace_start()
+{
+	origin = perf_now();
+	atomic_store(&enabled, 1);
+}
+
+/* returns 1 while recording */
+int
+trace_on()
+{
+	return atomic_load_explicit(&enabled, memory_order_relaxed);
+}
+
+/*
+ * Returns the calling thread's buffer, registering one on first use.
+ * returns NULL once TRACE_THREADS threads have registered
+ */
+static TraceBuffer*
+trace_buffer()
+{
+	int slot;
+
+	if (local != NULL) {
+		return local;
+	}
+
+	if (atomic_load(&nbuffers) >= TRACE_THREADS) {
+		return NULL;
+	}
+
+	slot = atomic_fetch_add(&nbuffers, 1);
+	if (slot >= TRACE_THREADS) {
+		return NULL;
+	}
+
+	local = calloc(1, sizeof(TraceBuffer));
+	if (local != NULL) {
+		snprintf(local->name, TRACE_NAME, "thread %d", slot);
+	}
+	atomic_store(&buffers[slot], local);
+	return local;
+}
+
+/* Names the calling thread's track. */
+void
+trace_thread(const char* name)
+{
+	TraceBuffer* buffer;
+
+	if (!trace_on() || (buffer = trace_buffer()) == NULL) {
+		return;
+	}
+
+	snprintf(buffer->name, TRACE_NAME, "%s", name);
+}
+
+/* returns the start time for trace_end, 0 while not recording */
+unsigned long long
+trace_begin()
+{
+	return trace_on() ? perf_now() : 0;
+}
+
+/* Records a span from start until now on the calling thread's track. */
+void
+trace_end(const char* name, unsigned long long start)
+{
+	TraceBuffer* buffer;
+	TRACE_EVENT* ev;
+	unsigned int count;
+
+	if (start == 0 || (buffer = trace_buffer()) == NULL) {
+		return;
+	}
+
+	count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+	if (count >= TRACE_EVENTS) {
+		buffer->dropped++;
+		return;
+	}
+
+	ev = &buffer->events[count];
+	ev->name = name;
+	ev->start = start;
+	ev->dur = perf_now() - start;
+
+	atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+/*
+ * Writes every recorded span as Chrome trace-event JSON.
+ * Safe while threads still record; spans after the call are not written.
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+trace_write(const char* path)
+{
+	FILE* file = fopen(path, "w");
+	TraceBuffer* buffer;
+	TRACE_EVENT* ev;
+	unsigned int count;
+	int threads = atomic_load(&nbuffers);
+	int first = 1;
+	int i;
+
+	if (file == NULL) {
+		perror(path);
+		return 0;
+	}
+
+	if (threads > TRACE_THREADS) {
+		threads = TRACE_THREADS;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	for (i = 0; i < threads; i++) {
+		buffer = atomic_load(&buffers[i]);
+		if (buffer == NULL) {
+			continue;
+		}
+
+		fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+			first ? "" : ",\n", i, buffer->name);
+		first = 0;
+
+		if (buffer->dropped > 0) {
+			fprintf(stderr, "trace: %s dropped %lu spans\n", buffer->name, buffer->dropped);
+		}
+
+		count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+		for (ev = buffer->events; ev < buffer->events + count; ev++) {
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+				ev->name, i, (ev->start - origin) / 1e3, ev->dur / 1e3);
+		}
+	}
+
+	fprintf(file, "\n]}\n");
+
+	if (fclose(file) != 0) {
+		perror(path);
+		return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,46 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+
+/*
+ * Host timing traces in Chrome trace-event format.
+ * Every thread records complete spans into its own buffer, so recording
+ * takes no locks and threads never share cache lines. trace_write dumps
+ * all buffers as JSON that chrome://tracing or Perfetto can open.
+ *
+ *   unsigned long long start = trace_begin();
+ *   ...
+ *   trace_end("frame", start);
+ *
+ * Span names must be string literals (they are kept by pointer).
+ * While tracing is off, trace_begin and trace_end only test a flag.
+ */
+#define TRACE_THREADS 16
+#define TRACE_EVENTS (1 << 18) /* spans per thread, extra ones are dropped */
+#define TRACE_NAME 32
+
+typedef struct traceEvent TRACE_EVENT;
+typedef struct traceBuffer TraceBuffer;
+
+struct traceEvent {
+	const char* name;
+	unsigned long long start;  /* ns, perf_now() clock */
+	unsigned long long dur;
+};
+
+struct traceBuffer {
+	char name[TRACE_NAME];     /* thread name */
+	atomic_uint count;
+	unsigned long dropped;
+	TRACE_EVENT events[TRACE_EVENTS];
+};
+
+void trace_start();
+int trace_on();
+void trace_thread(const char* name);
+unsigned long long trace_begin();
+void trace_end(const char* name, unsigned long long start);
+int trace_write(const char* path);
+
+#endif
@@ -0,0 +1,520 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <termios.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "core.h"
+#include "script.h"
+#include "export.h"
+#include "budget.h"
+
+/*
+ * Terminal debugger frontend.
+ * Draws the same views as the SDL frontend into a cell buffer and only
+ * sends the cells that changed since the last frame, using cursor
+ * addressing escape sequences. That keeps it usable over slow SSH links.
+ */
+int startTerm();
+void closeTerm();
+void drawMemory(int row, unsigned short base);
+void drawCPU();
+void drawBudget(int row, int col);
+void drawString(int row, int col, char* chars, unsigned char attr);
+void present();
+void usage(char* program);
+
+/* macros */
+#define ROWS 36
+#define COLS 80
+#define FRAME_MS 33 /* ~30 redraws per second */
+
+#define ATTR_NONE 0
+#define ATTR_BOLD (1 << 0)
+#define ATTR_REVERSE (1 << 1)
+
+typedef struct cell CELL;
+
+struct cell {
+	char ch;
+	unsigned char attr;
+};
+
+/* Variables */
+Bus nes;
+CPU cpu_descriptor;
+CPU* cpu;
+Script script;
+Export shared;
+Prof prof;
+Budget budget;
+int monitor = 0;
+CELL screen[ROWS][COLS];  /* frame being drawn */
+CELL shown[ROWS][COLS];   /* what the terminal currently displays */
+struct termios savedTerm;
+unsigned short viewport1;
+unsigned short viewport2;
+unsigned char breakpoint[MEM_SIZE];
+int running = 0;
+volatile sig_atomic_t interrupted = 0;
+
+/*
+ * puts the terminal into raw mode on the alternate screen
+ * returns 1 on success
+ * returns 0 on fail
+ */
+int
+startTerm()
+{
+	struct termios raw;
+
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &savedTerm) < 0) {
+		fprintf(stderr, "stdin is not a terminal\n");
+		return 0;
+	}
+
+	raw = savedTerm;
+	raw.c_lflag &= ~(ICANON | ECHO);
+	raw.c_cc[VMIN] = 0;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+	/* alternate screen, hide cursor, clear */
+	printf("\033[?1049h\033[?25l\033[2J");
+	fflush(stdout);
+
+	memset(shown, 0, sizeof(shown));
+	for (int r = 0; r < ROWS; r++) {
+		for (int c = 0; c < COLS; c++) {
+			shown[r][c].ch = ' ';
+		}
+	}
+
+	return 1;
+}
+
+/*
+ * restores the terminal
+ */
+void
+closeTerm()
+{
+	printf("\033[0m\033[?25h\033[?1049l");
+	fflush(stdout);
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &savedTerm);
+}
+
+void
+onSignal(int sig)
+{
+	(void)sig;
+	interrupted = 1;
+}
+
+void
+drawString(int row, int col, char* chars, unsigned char attr)
+{
+	for (; *chars != '\0' && col < COLS; chars++, col++) {
+		screen[row][col].ch = *chars;
+		screen[row][col].attr = attr;
+	}
+}
+
+void
+drawMemory(int row, unsigned short base)
+{
+	char temp[8];
+	unsigned short addr;
+
+	for (int i = 0; i < 16; i++) {
+		sprintf(temp, "$%04X", (unsigned short)(base + i * 16));
+		drawString(row + i, 0, temp, ATTR_BOLD);
+
+		for (int j = 0; j < 16; j++) {
+			addr = base + i * 16 + j;
+			sprintf(temp, "%02X", bus_peek(&nes, addr));
+			drawString(row + i, 6 + j * 3, temp,
+				(addr == cpu->pc ? ATTR_REVERSE : ATTR_NONE) | (breakpoint[addr] ? ATTR_BOLD : ATTR_NONE));
+		}
+	}
+}
+
+void
+drawCPU()
+{
+	char buff[200];
+	int x = 56;
+	int y = 0;
+	drawString(y, x, "STATUS:", ATTR_BOLD);
+	drawString(y, x + 8, (cpu->status&N)? "N":"-", ATTR_NONE);
+	drawString(y, x + 10, (cpu->status&V)? "V":"-", ATTR_NONE);
+	drawString(y, x + 12, (cpu->status&U)? "-":"-", ATTR_NONE);
+	drawString(y, x + 14, (cpu->status&B)? "B":"-", ATTR_NONE);
+	drawString(y, x + 16, (cpu->status&D)? "D":"-", ATTR_NONE);
+	drawString(y, x + 18, (cpu->status&I)? "I":"-", ATTR_NONE);
+	drawString(y, x + 20, (cpu->status&Z)? "Z":"-", ATTR_NONE);
+	drawString(y, x + 22, (cpu->status&C)? "C":"-", ATTR_NONE);
+	sprintf(buff, "PC: $%04X", cpu->pc);
+	drawString(y + 1, x, buff, ATTR_NONE);
+	sprintf(buff, "A: $%04X", cpu->a);
+	drawString(y + 2, x, buff, ATTR_NONE);
+	sprintf(buff, "X: $%04X", cpu->x);
+	drawString(y + 3, x, buff, ATTR_NONE);
+	sprintf(buff, "Y: $%04X", cpu->y);
+	drawString(y + 4, x, buff, ATTR_NONE);
+	sprintf(buff, "STACK: $%04X", cpu->stkp);
+	drawString(y + 5, x, buff, ATTR_NONE);
+	sprintf(buff, "OPCODE: %s", cpu_getOpcode(cpu));
+	drawString(y + 6, x, buff, ATTR_NONE);
+	drawString(y + 8, x, running ? "RUNNING" : "STOPPED", ATTR_REVERSE);
+}
+
+/* Frame budget histogram and worst cases, with --budget */
+void
+drawBudget(int row, int col)
+{
+	BudgetReport report;
+	char buff[COLS];
+
+	budget_report(&budget, &report);
+
+	sprintf(buff, "BUSY %u NMI %u", report.lastBusy, report.lastNmi);
+	drawString(row, col, buff, ATTR_BOLD);
+	for (int i = 0; i < BUDGET_BUCKETS; i++) {
+		budget_bar(&report, i, 9, buff, sizeof(buff));
+		drawString(row + 1 + i, col, buff, i == BUDGET_BUCKETS - 1 ? ATTR_BOLD : ATTR_NONE);
+	}
+	sprintf(buff, "worst %u/%u/%u", report.worstBusy, report.worstNmi, report.worstLatency);
+	drawString(row + 2 + BUDGET_BUCKETS, col, buff, ATTR_NONE);
+}
+
+/* Returns 1 if the cells in row from..to-1 are all shown with the input attribute. */
+static int
+gapMatches(int row, int from, int to, int attr)
+{
+	for (; from < to; from++) {
+		if (shown[row][from].attr != attr || shown[row][from].ch == '\0') {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/*
+ * sends every cell that differs from what the terminal shows
+ * cursor moves are only emitted when the next changed cell
+ * is not where the cursor already is
+ */
+void
+present()
+{
+	static char out[ROWS * COLS * 24];
+	int n = 0;
+	int curRow = -1, curCol = -1;
+	int attr = -1;
+	CELL* want;
+
+	for (int r = 0; r < ROWS; r++) {
+		for (int c = 0; c < COLS; c++) {
+			want = &screen[r][c];
+
+			if (want->ch == shown[r][c].ch && want->attr == shown[r][c].attr) {
+				continue;
+			}
+
+			/* reprinting a short run of unchanged cells is cheaper than a cursor move */
+			if (r == curRow && c > curCol && c - curCol <= 4 && gapMatches(r, curCol, c, attr)) {
+				for (; curCol < c; curCol++) {
+					out[n++] = shown[r][curCol].ch;
+				}
+			}
+
+			if (r != curRow || c != curCol) {
+				n += sprintf(out + n, "\033[%d;%dH", r + 1, c + 1);
+			}
+
+			if (want->attr != attr) {
+				n += sprintf(out + n, "\033[0%s%sm",
+					(want->attr & ATTR_BOLD) ? ";1" : "",
+					(want->attr & ATTR_REVERSE) ? ";7" : "");
+				attr = want->attr;
+			}
+
+			out[n++] = want->ch;
+			shown[r][c] = *want;
+			curRow = r;
+			curCol = c + 1;
+		}
+	}
+
+	if (n > 0) {
+		n += sprintf(out + n, "\033[0m");
+		if (write(STDOUT_FILENO, out, n) < 0) {
+			interrupted = 1;
+		}
+	}
+}
+
+/*
+ * Usage Function
+ * Called when something isn't right with the command line parameters.
+ */
+void
+usage(char* program)
+{
+	printf("Usage: %s \n[--save filename] [--script filename] [--shm name] \n[--viewport1 addr] [--viewport2 addr] [--break addr] [--profile file] \n[--budget file.csv] [--frames n]\n", program);
+}
+
+int
+main(int argc, char* argv[])
+{
+	/* Battery-backed save file for $6000-$7FFF */
+	char* save = NULL;
+	time_t lastFlush = 0;
+
+	/* Automation script */
+	char* scriptFile = NULL;
+
+	/* Shared memory segment for external viewers */
+	char* shmName = NULL;
+
+	/* Guest call profile, folded stacks */
+	char* profFile = NULL;
+
+	/* Frame budget monitor, and frames to run without a terminal */
+	char* budgetFile = NULL;
+	unsigned long runFrames = 0;
+	BudgetReport report;
+	char bar[COLS];
+
+	/* Params for getopt */
+	int ch;
+	int option_index = 0;
+
+	/* Defines the options and their long/short equivalents. */
+	struct option longopts[] = {
+		{ "save", required_argument, NULL, 's'},
+		{ "script", required_argument, NULL, 'S'},
+		{ "shm", required_argument, NULL, 'm'},
+		{ "viewport-1", required_argument, NULL, '1' },
+		{ "viewport-2", required_argument, NULL, '2' },
+		{ "break", required_argument, NULL, 'b' },
+		{ "profile", required_argument, NULL, 'P' },
+		{ "budget", required_argument, NULL, 'B' },
+		{ "frames", required_argument, NULL, 'n' },
+		{ "help", no_argument, NULL, 'h'},
+		{ NULL, 0, NULL, 0 }
+	};
+
+	/* loop flag */
+	int quit = 0;
+	char key;
+	unsigned long frame;
+
+	viewport1 = 0x0000;
+	viewport2 = 0x0100;
+
+	/* Processes the command-line parameters */
+	while ((ch = getopt_long(argc, argv, "s:S:m:1:2:b:P:B:n:h", longopts, &option_index)) != -1) {
+		switch (ch) {
+
+			case '1':
+				viewport1 = strtol(optarg, NULL, 16);
+				break;
+
+			case '2':
+				viewport2 = strtol(optarg, NULL, 16);
+				break;
+
+			case 'b':
+				breakpoint[(unsigned short)strtol(optarg, NULL, 16)] = 1;
+				break;
+
+			case 's':
+				save = optarg;
+				break;
+
+			case 'S':
+				scriptFile = optarg;
+				break;
+
+			case 'm':
+				shmName = optarg;
+				break;
+
+			case 'P':
+				profFile = optarg;
+				break;
+
+			case 'B':
+				budgetFile = optarg;
+				monitor = 1;
+				break;
+
+			case 'n':
+				runFrames = strtoul(optarg, NULL, 10);
+				break;
+
+			case 'h':
+				printf("Keys: space steps, r runs/stops, b toggles a breakpoint at PC, q quits.\n");
+				printf("--budget shows the frame budget histogram and writes a row per frame (- for none).\n--frames runs that many frames without a terminal and exits.\n\n");
+				usage(argv[0]);
+				return 0;
+
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	cpu = &cpu_descriptor;
+	core_start(&nes, cpu);
+
+	if (save != NULL && !bus_mapSram(&nes, save)) {
+		fprintf(stderr, "Save RAM could not be mapped, continuing without it.\n");
+	}
+
+	if (shmName != NULL && !export_open(&shared, shmName, cpu)) {
+		fprintf(stderr, "Shared memory export could not be opened, continuing without it.\n");
+	}
+
+	if (scriptFile != NULL && !script_load(&script, scriptFile, cpu)) {
+		return 1;
+	}
+
+	if (profFile != NULL) {
+		prof_init(&prof, cpu->clocks);
+		cpu->prof = &prof;
+	}
+
+	/* "-" monitors without writing a CSV */
+	if (monitor && !budget_attach(&budget, cpu, strcmp(budgetFile, "-") != 0 ? budgetFile : NULL)) {
+		return 1;
+	}
+
+	if (runFrames > 0) {
+		/* headless: run the frames, then report */
+		while (nes.frames < runFrames && !script.quit) {
+			core_frame(cpu);
+		}
+		quit = 1;
+	} else if (!startTerm()) {
+		return 1;
+	}
+
+	signal(SIGINT, onSignal);
+	signal(SIGTERM, onSignal);
+
+	while (!quit && !interrupted) {
+		struct pollfd in = { STDIN_FILENO, POLLIN, 0 };
+
+		/* handle input, waiting out the rest of the frame */
+		if (poll(&in, 1, FRAME_MS) > 0) {
+			while (read(STDIN_FILENO, &key, 1) == 1) {
+				switch (key) {
+					case ' ':
+						running = 0;
+						core_step(cpu);
+						break;
+
+					case 'r':
+						running = !running;
+						break;
+
+					case 'b':
+						breakpoint[cpu->pc] = !breakpoint[cpu->pc];
+						break;
+
+					case 0x0C: /* ctrl-l repaints everything */
+						memset(shown, 0, sizeof(shown));
+						printf("\033[2J");
+						fflush(stdout);
+						break;
+
+					case 'q':
+						quit = 1;
+						break;
+				}
+			}
+		}
+
+		/* run until the frame ends, stopping at breakpoints */
+		if (running) {
+			frame = nes.frames;
+			while (nes.frames == frame) {
+				core_step(cpu);
+				if (breakpoint[cpu->pc]) {
+					running = 0;
+					break;
+				}
+			}
+		}
+
+		/* drawing */
+		memset(screen, 0, sizeof(screen));
+		for (int r = 0; r < ROWS; r++) {
+			for (int c = 0; c < COLS; c++) {
+				screen[r][c].ch = ' ';
+			}
+		}
+
+		drawMemory(0, viewport1);
+		drawMemory(17, viewport2);
+		drawCPU();
+		if (monitor) {
+			drawBudget(10, 56);
+		}
+		drawString(ROWS - 1, 0, "space step  r run/stop  b break at PC  ^L redraw  q quit", ATTR_NONE);
+
+		present();
+
+		if (script.quit) {
+			quit = 1;
+		}
+
+		/* schedule save RAM writeback, never on the guest's write path */
+		if (time(NULL) != lastFlush) {
+			bus_flushSram(&nes);
+			lastFlush = time(NULL);
+		}
+	}
+
+	if (runFrames == 0) {
+		closeTerm();
+	}
+
+	if (monitor) {
+		budget_report(&budget, &report);
+		fprintf(stderr, "frames %lu, lag %lu, worst busy %u, worst nmi %u, worst nmi latency %u cycles of %d\n",
+			report.frames, report.lags, report.worstBusy, report.worstNmi, report.worstLatency, FRAME_CYCLES);
+		for (int i = 0; i < BUDGET_BUCKETS; i++) {
+			budget_bar(&report, i, 40, bar, sizeof(bar));
+			fprintf(stderr, "%s\n", bar);
+		}
+		budget_detach(&budget);
+	}
+
+	bus_unmapSram(&nes);
+	export_close(&shared);
+
+	if (profFile != NULL) {
+		prof_sync(&prof, cpu->clocks);
+		prof_report(&prof, stderr, nes.frames, 20);
+		prof_write(&prof, profFile);
+	}
+
+	if (scriptFile != NULL) {
+		script_unload(&script);
+		if (script.failures > 0) {
+			fprintf(stderr, "%d assertion(s) failed\n", script.failures);
+			return 1;
+		}
+	}
+
+	return 0;
+}